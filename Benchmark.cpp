@@ -0,0 +1,394 @@
+// Benchmarks of training, inference and model and csv I/O on synthetic passenger data:
+//   Benchmark [--rows=N] [--sex-levels=N] [--embarked-levels=N] [--trees=N] [--depth=N] [--bins=N]
+//             [--threads=N] [--repeat=N] [--passenger-limit=N] [--dir=PATH] [--seed=N] [--telemetry=PATH]
+//             [--wide-columns=N]
+// Every measurement is written to stdout as one JSON object per line, so runs of different
+// releases can be compared by a script. Steps that need std::vector<Passenger> (loadData,
+// predict(Passenger)) only run when rows <= passenger-limit, since those records are large.
+// --telemetry writes the TrainingTelemetry report of the forest_train run to PATH.
+// --wide-columns sets the width of the generic table (see FeatureSchema) of the wide_* steps, 0 skips them.
+#include "CompactForest.h"
+#include "CsvLoader.h"
+#include "ModelFile.h"
+#include "RandomForest.h"
+#include "Telemetry.h"
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+struct BenchmarkConfig {
+    long long rows = 100000;
+    int sexLevels = 2;
+    int embarkedLevels = 4; //at most EmbarkedSymbols: only the first character of Embarked is used
+    int trees = 100;
+    int depth = 7;
+    int bins = 0;
+    int threads = 0;
+    int repeat = 3;
+    long long passengerLimit = 1000000;
+    std::string dir = ".";
+    unsigned seed = 42;
+    std::string telemetry; //report file, empty for none
+    int wideColumns = 100;
+};
+
+static const char EmbarkedSymbols[] = "SCQABDEFGHIJKLMNOPRTVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+
+// One JSON object per line: {"benchmark":"...","key":value,...}
+class JsonLine {
+private:
+    std::ostringstream out;
+
+public:
+    explicit JsonLine(const std::string& benchmark) {
+        out << "{\"benchmark\":\"" << benchmark << "\"";
+    }
+
+    JsonLine& field(const char* key, double value) {
+        out << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    JsonLine& field(const char* key, long long value) {
+        out << ",\"" << key << "\":" << value;
+        return *this;
+    }
+
+    JsonLine& field(const char* key, int value) {
+        return field(key, (long long)value);
+    }
+
+    JsonLine& field(const char* key, const std::string& value) {
+        out << ",\"" << key << "\":\"" << value << "\"";
+        return *this;
+    }
+
+    ~JsonLine() {
+        std::cout << out.str() << "}" << std::endl;
+    }
+};
+
+// Fastest of repeat runs, in seconds
+template <typename Body>
+double bestTime(int repeat, Body body) {
+    double best = 0.0;
+    for (int i = 0; i < std::max(1, repeat); ++i) {
+        auto start = std::chrono::steady_clock::now();
+        body();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+static long long fileSize(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? (long long)file.tellg() : -1;
+}
+
+static void appendNumber(std::string& line, long long value) {
+    char buffer[24];
+    auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    line.append(buffer, result.ptr);
+}
+
+// Writes a titanic-shaped csv of config.rows passengers. Survival follows a noisy rule over
+// sex, class, age, family size, fare and port, so the trees have structure to learn.
+static void generateCsv(const std::string& path, const BenchmarkConfig& config) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) throw std::runtime_error("cannot write " + path);
+    out << "PassengerId,Survived,Pclass,Name,Sex,Age,SibSp,Parch,Ticket,Fare,Cabin,Embarked\n";
+
+    std::mt19937_64 rng(config.seed);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::geometric_distribution<int> family(0.6);
+    std::vector<std::string> sexes;
+    for (int level = 0; level < config.sexLevels; ++level)
+        sexes.push_back(config.sexLevels == 2 ? (level == 0 ? "male" : "female") : "sex" + std::to_string(level));
+    int nPorts = std::clamp(config.embarkedLevels, 1, (int)sizeof(EmbarkedSymbols) - 1);
+
+    std::string line;
+    for (long long id = 1; id <= config.rows; ++id) {
+        int pclass = 1 + (int)(unit(rng) * unit(rng) * 3.0 + unit(rng) * 1.2) % 3;
+        int sex = (int)(unit(rng) * sexes.size());
+        int age = unit(rng) < 0.2 ? -1 : (int)std::clamp(30.0 + 14.0 * noise(rng), 0.0, 80.0);
+        int sibSp = std::min(family(rng), 8);
+        int parch = std::min(family(rng), 6);
+        int fare = unit(rng) < 0.02 ? -1 : (int)(std::exp(4.6 - 0.8 * pclass + 0.7 * noise(rng)));
+        int port = unit(rng) < 0.01 ? -1 : (int)(unit(rng) * unit(rng) * nPorts);
+
+        double score = (sex % 2 == 1 ? 2.4 : -0.4) + (2 - pclass) * 0.9 + (age >= 0 && age < 12 ? 1.1 : 0.0)
+            - (sibSp + parch > 4 ? 1.5 : 0.0) + std::max(fare, 0) / 150.0 + (port == 1 ? 0.3 : 0.0) - 0.6 + noise(rng);
+        bool survived = score > 0;
+
+        line.clear();
+        appendNumber(line, id);
+        line += survived ? ",1," : ",0,";
+        appendNumber(line, pclass);
+        line += ",\"Surname";
+        appendNumber(line, id % 9973);
+        line += ", Mx. Given\",";
+        line += sexes[sex];
+        line += ',';
+        if (age >= 0) appendNumber(line, age);
+        line += ',';
+        appendNumber(line, sibSp);
+        line += ',';
+        appendNumber(line, parch);
+        line += ",T";
+        appendNumber(line, id);
+        line += ',';
+        if (fare >= 0) appendNumber(line, fare);
+        line += ',';
+        if (unit(rng) < 0.3) {
+            line += 'C';
+            appendNumber(line, id % 200);
+        }
+        line += ',';
+        if (port >= 0) line += EmbarkedSymbols[port];
+        line += '\n';
+        out.write(line.data(), line.size());
+    }
+}
+
+// Writes a csv of config.rows rows of wideColumns numeric columns x0, x1, ... (about 2% empty)
+// and a categorical column "group", with a label column "label" decided by a few of them.
+static std::shared_ptr<const FeatureSchema> generateWideCsv(const std::string& path, const BenchmarkConfig& config) {
+    std::ofstream out(path, std::ios::binary);
+    if (!out.is_open()) throw std::runtime_error("cannot write " + path);
+    std::vector<FeatureSpec> features;
+    std::string line = "label";
+    for (int column = 0; column < config.wideColumns; ++column) {
+        features.push_back({ "x" + std::to_string(column), FeatureKind::Numeric });
+        line += "," + features.back().name;
+    }
+    features.push_back({ "group", FeatureKind::Categorical });
+    line += ",group\n";
+    out.write(line.data(), line.size());
+
+    std::mt19937_64 rng(config.seed);
+    std::uniform_int_distribution<int> value(0, 999);
+    std::normal_distribution<double> noise(0.0, 1.0);
+    std::vector<int> values(config.wideColumns);
+    for (long long id = 0; id < config.rows; ++id) {
+        for (int& v : values) v = value(rng);
+        int group = value(rng) % 8;
+        double score = (values[0] - 500) / 150.0 + (values[config.wideColumns / 2] > 700 ? 1.0 : -0.5)
+            + (values[config.wideColumns - 1] < 100 ? 1.5 : 0.0) + (group < 3 ? 0.8 : -0.4) + noise(rng);
+        line = score > 0 ? "1" : "0";
+        for (int v : values) {
+            line += ',';
+            if (v >= 20) appendNumber(line, v);
+        }
+        line += ",g";
+        appendNumber(line, group);
+        line += '\n';
+        out.write(line.data(), line.size());
+    }
+    return std::make_shared<const FeatureSchema>(std::move(features));
+}
+
+static bool parseArgument(const std::string& argument, BenchmarkConfig& config) {
+    size_t equals = argument.find('=');
+    if (argument.compare(0, 2, "--") != 0 || equals == std::string::npos) return false;
+    std::string key = argument.substr(2, equals - 2), value = argument.substr(equals + 1);
+    if (key == "rows") config.rows = std::stoll(value);
+    else if (key == "sex-levels") config.sexLevels = std::max(1, std::stoi(value));
+    else if (key == "embarked-levels") config.embarkedLevels = std::max(1, std::stoi(value));
+    else if (key == "trees") config.trees = std::stoi(value);
+    else if (key == "depth") config.depth = std::stoi(value);
+    else if (key == "bins") config.bins = std::stoi(value);
+    else if (key == "threads") config.threads = std::stoi(value);
+    else if (key == "repeat") config.repeat = std::stoi(value);
+    else if (key == "passenger-limit") config.passengerLimit = std::stoll(value);
+    else if (key == "dir") config.dir = value;
+    else if (key == "seed") config.seed = (unsigned)std::stoul(value);
+    else if (key == "telemetry") config.telemetry = value;
+    else if (key == "wide-columns") config.wideColumns = std::max(0, std::stoi(value));
+    else return false;
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    BenchmarkConfig config;
+    for (int i = 1; i < argc; ++i) {
+        if (!parseArgument(argv[i], config)) {
+            std::cerr << "usage: " << argv[0] << " [--rows=N] [--sex-levels=N] [--embarked-levels=N] [--trees=N] [--depth=N]"
+                " [--bins=N] [--threads=N] [--repeat=N] [--passenger-limit=N] [--dir=PATH] [--seed=N] [--telemetry=PATH]"
+                " [--wide-columns=N]\n";
+            return 1;
+        }
+    }
+    std::string csvFile = config.dir + "/benchmark_data.csv";
+    std::string modelFile = config.dir + "/benchmark_forest.bin";
+    std::string mappedFile = config.dir + "/benchmark_forest.rfm";
+    bool passengers = config.rows <= config.passengerLimit;
+
+    JsonLine("config").field("rows", config.rows).field("sex_levels", config.sexLevels).field("embarked_levels", config.embarkedLevels)
+        .field("trees", config.trees).field("depth", config.depth).field("bins", config.bins).field("threads", config.threads)
+        .field("hardware_threads", (int)std::thread::hardware_concurrency()).field("repeat", config.repeat)
+        .field("wide_columns", config.wideColumns);
+
+    double seconds = bestTime(1, [&] { generateCsv(csvFile, config); });
+    long long csvBytes = fileSize(csvFile);
+    double megabytes = csvBytes / 1e6;
+    JsonLine("generate_csv").field("seconds", seconds).field("bytes", csvBytes).field("mb_per_second", megabytes / seconds);
+
+    //csv input
+    Dataset data;
+    for (int threads : { 1, config.threads }) {
+        seconds = bestTime(config.repeat, [&] { data = CsvLoader::load(csvFile, threads); });
+        JsonLine("csv_load_dataset").field("threads", threads).field("seconds", seconds).field("mb_per_second", megabytes / seconds)
+            .field("rows_per_second", data.size() / seconds);
+    }
+    seconds = bestTime(config.repeat, [&] {
+        CsvChunkReader reader(csvFile);
+        Dataset chunk;
+        while (reader.next(chunk)) {}
+    });
+    JsonLine("csv_stream_chunks").field("seconds", seconds).field("mb_per_second", megabytes / seconds);
+    std::vector<Passenger> records;
+    if (passengers) {
+        seconds = bestTime(config.repeat, [&] {
+            std::ifstream file(csvFile);
+            records = CsvLoader::loadPassengers(file);
+        });
+        JsonLine("csv_load_passengers").field("seconds", seconds).field("mb_per_second", megabytes / seconds)
+            .field("rows_per_second", records.size() / seconds);
+    }
+
+    //training
+    long long rows = (long long)data.size();
+    for (int threads : { 1, config.threads }) {
+        DecisionTree tree(config.depth, 2, 2, 1.0, config.bins, threads);
+        seconds = bestTime(config.repeat, [&] { tree.train(data, config.seed); });
+        JsonLine("tree_train").field("threads", threads).field("seconds", seconds).field("rows_per_second", rows / seconds)
+            .field("nodes", (long long)tree.getNodes().size()).field("levels", tree.depth());
+    }
+    RandomForest forest(config.trees, config.depth, 2, 2, 0.7, config.bins, config.threads, config.seed);
+    TrainingTelemetry telemetry;
+    if (!config.telemetry.empty()) forest.setTelemetry(&telemetry);
+    seconds = bestTime(1, [&] { forest.train(data); });
+    forest.setTelemetry(nullptr);
+    JsonLine("forest_train").field("threads", config.threads).field("seconds", seconds)
+        .field("tree_rows_per_second", (double)rows * config.trees / seconds).field("oob_accuracy", forest.outOfBagAccuracy());
+    if (!config.telemetry.empty()) telemetry.writeJson(config.telemetry);
+    RandomForest extraForest(config.trees, config.depth, 2, 2, 0.7, config.bins, config.threads, config.seed, true);
+    seconds = bestTime(1, [&] { extraForest.train(data); });
+    JsonLine("forest_train_extra").field("threads", config.threads).field("seconds", seconds)
+        .field("tree_rows_per_second", (double)rows * config.trees / seconds).field("oob_accuracy", extraForest.outOfBagAccuracy());
+
+    //inference
+    for (int threads : { 1, config.threads }) {
+        std::vector<double> probabilities;
+        seconds = bestTime(config.repeat, [&] { probabilities = forest.predictBatch(data, threads); });
+        JsonLine("forest_predict_batch").field("threads", threads).field("seconds", seconds).field("rows_per_second", rows / seconds);
+    }
+    double accuracy = 0.0;
+    seconds = bestTime(config.repeat, [&] { accuracy = forest.evaluate(data, config.threads); });
+    JsonLine("forest_evaluate").field("threads", config.threads).field("seconds", seconds).field("rows_per_second", rows / seconds)
+        .field("accuracy", accuracy);
+    if (passengers) {
+        long long survived = 0;
+        seconds = bestTime(config.repeat, [&] {
+            survived = 0;
+            for (const Passenger& p : records) survived += forest.predict(p);
+        });
+        JsonLine("forest_predict_passenger").field("seconds", seconds).field("rows_per_second", records.size() / seconds);
+
+        //early exit at 99% confidence, before and after putting the most decisive trees first
+        std::vector<char> exact(records.size());
+        for (size_t i = 0; i < records.size(); ++i) exact[i] = forest.predict(records[i]);
+        for (bool ordered : { false, true }) {
+            if (ordered) forest.orderTreesForEarlyExit(records);
+            long long treesRun = 0, agree = 0;
+            seconds = bestTime(config.repeat, [&] {
+                treesRun = agree = 0;
+                for (size_t i = 0; i < records.size(); ++i) {
+                    int n = 0;
+                    agree += forest.predict(records[i], 0.99, &n) == (exact[i] != 0);
+                    treesRun += n;
+                }
+            });
+            JsonLine("forest_predict_passenger_confident").field("ordered", (int)ordered).field("seconds", seconds)
+                .field("rows_per_second", records.size() / seconds).field("mean_trees", (double)treesRun / records.size())
+                .field("agreement", (double)agree / records.size());
+        }
+    }
+
+    //model files
+    seconds = bestTime(config.repeat, [&] { forest.save(modelFile); });
+    JsonLine("forest_save").field("seconds", seconds).field("bytes", fileSize(modelFile));
+    seconds = bestTime(config.repeat, [&] {
+        RandomForest loaded;
+        loaded.load(modelFile);
+    });
+    JsonLine("forest_load").field("seconds", seconds);
+    seconds = bestTime(config.repeat, [&] { MappedForest::save(forest, mappedFile); });
+    JsonLine("mapped_save").field("seconds", seconds).field("bytes", fileSize(mappedFile));
+    seconds = bestTime(config.repeat, [&] { MappedForest mapped(mappedFile); });
+    JsonLine("mapped_open").field("seconds", seconds);
+    MappedForest mapped(mappedFile);
+    seconds = bestTime(config.repeat, [&] { mapped.predictBatch(data, config.threads); });
+    JsonLine("mapped_predict_batch").field("threads", config.threads).field("seconds", seconds).field("rows_per_second", rows / seconds);
+
+    //compact nodes; a forest they cannot hold is reported and skipped
+    std::string compactFile = config.dir + "/benchmark_forest.rfc";
+    std::unique_ptr<CompactForest> compact;
+    try {
+        seconds = bestTime(config.repeat, [&] { compact = std::make_unique<CompactForest>(forest); });
+        size_t fullBytes = 0;
+        for (const DecisionTree& tree : forest.getTrees()) fullBytes += tree.getNodes().size() * sizeof(TreeNode);
+        JsonLine("compact_build").field("seconds", seconds).field("node_bytes", (long long)compact->nodeBytes())
+            .field("full_node_bytes", (long long)fullBytes).field("matches", (int)compact->matches(forest));
+        seconds = bestTime(config.repeat, [&] { compact->save(compactFile); });
+        JsonLine("compact_save").field("seconds", seconds).field("bytes", fileSize(compactFile));
+        for (int threads : { 1, config.threads }) {
+            seconds = bestTime(config.repeat, [&] { compact->predictBatch(data, threads); });
+            JsonLine("compact_predict_batch").field("threads", threads).field("seconds", seconds).field("rows_per_second", rows / seconds);
+        }
+    }
+    catch (const std::runtime_error& e) {
+        JsonLine("compact_skipped").field("reason", std::string(e.what()));
+    }
+
+    //compression: redundant splits collapsed, then identical subtrees shared in compact nodes
+    RandomForest collapsed = forest;
+    size_t removed = 0;
+    seconds = bestTime(1, [&] { removed = collapsed.collapseRedundantSplits(); });
+    JsonLine("compress_collapse").field("seconds", seconds).field("nodes", (long long)forest.nodeCount())
+        .field("nodes_removed", (long long)removed);
+    try {
+        seconds = bestTime(config.repeat, [&] { compact = std::make_unique<CompactForest>(collapsed, true); });
+        JsonLine("compress_share").field("seconds", seconds).field("nodes", (long long)compact->nodeCount())
+            .field("node_bytes", (long long)compact->nodeBytes()).field("matches", (int)compact->matches(forest));
+        seconds = bestTime(config.repeat, [&] { compact->predictBatch(data, config.threads); });
+        JsonLine("compress_predict_batch").field("threads", config.threads).field("seconds", seconds).field("rows_per_second", rows / seconds);
+    }
+    catch (const std::runtime_error& e) {
+        JsonLine("compress_share_skipped").field("reason", std::string(e.what()));
+    }
+
+    //wide generic table
+    if (config.wideColumns > 0) {
+        std::string wideFile = config.dir + "/benchmark_wide.csv";
+        std::shared_ptr<const FeatureSchema> schema;
+        seconds = bestTime(1, [&] { schema = generateWideCsv(wideFile, config); });
+        long long wideBytes = fileSize(wideFile);
+        JsonLine("wide_generate_csv").field("seconds", seconds).field("bytes", wideBytes).field("features", schema->featureCount());
+        Dataset wide;
+        seconds = bestTime(config.repeat, [&] { wide = CsvLoader::loadTable(wideFile, schema, "label", config.threads); });
+        JsonLine("wide_csv_load").field("threads", config.threads).field("seconds", seconds).field("mb_per_second", wideBytes / 1e6 / seconds)
+            .field("rows_per_second", wide.size() / seconds);
+        RandomForest wideForest(config.trees, config.depth, 2, 2, 0.7, config.bins, config.threads, config.seed);
+        seconds = bestTime(1, [&] { wideForest.train(wide); });
+        JsonLine("wide_forest_train").field("threads", config.threads).field("seconds", seconds)
+            .field("tree_rows_per_second", (double)wide.size() * config.trees / seconds).field("oob_accuracy", wideForest.outOfBagAccuracy());
+        seconds = bestTime(config.repeat, [&] { wideForest.predictBatch(wide, config.threads); });
+        JsonLine("wide_predict_batch").field("threads", config.threads).field("seconds", seconds).field("rows_per_second", wide.size() / seconds);
+    }
+    return 0;
+}
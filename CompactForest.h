@@ -0,0 +1,535 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "ModelFile.h"
+#include "RandomForest.h"
+
+//Node of a CompactForest, 8 bytes. One child of a split is the next node (the near child) and
+//only the signed distance to the other one (the far child) is kept; the near child is the left
+//one unless the node is swapped. Trees are stored in preorder, or share subtrees when built so.
+struct CompactNode {
+    int32_t threshold; //numeric split: left if value <= threshold; categorical split: see CompactSetFlag
+    uint32_t packed; //bits 0-2 feature (CompactLeaf for leaves), bit 3 categorical split or leaf class, bit 4 swapped, bits 5-31 far child offset
+};
+
+constexpr uint32_t CompactLeaf = 7;
+constexpr int32_t CompactMaxOffset = (1 << 26) - 1;
+constexpr int32_t CompactMissing = std::numeric_limits<int32_t>::max(); //encoded missing value, above every threshold
+constexpr int CompactInlineCategories = 31; //category codes a categorical split can hold in its threshold
+//Threshold bit of a categorical split: clear, bits 0-30 are the set of category codes going left;
+//set, bits 0-30 are the offset of that set in the forest's category sets (as DecisionTree's)
+constexpr uint32_t CompactSetFlag = 1u << 31;
+
+static_assert(NumFeatures <= (int)CompactLeaf, "feature index must fit in 3 bits next to the leaf marker");
+static_assert(sizeof(CompactNode) == 8, "CompactNode layout is part of the file format");
+
+//Compact file format (version 2), integers in the writer's byte order:
+//  CompactFileHeader, uint32 root node of every tree, uint32 levels of every tree,
+//  CompactNode[nodeCount], category table as in the mapped format, uint64 count and category set words
+//Version 1 held a single category code as the threshold of categorical splits and is not read; its
+//forests can be converted again.
+constexpr char CompactFileMagic[8] = { 'R', 'F', 'C', 'M', 'P', 'C', 'T', '\0' };
+constexpr uint32_t CompactFileVersion = 2;
+
+struct CompactFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder; //ModelFileByteOrder
+    uint32_t nodeSize;
+    uint32_t featureCount;
+    uint32_t treeCount;
+    uint32_t nodeCount;
+};
+
+static_assert(sizeof(CompactFileHeader) == 32, "CompactFileHeader layout is part of the file format");
+
+
+//Inference-only copy of a RandomForest in 8-byte nodes, a third of a TreeNode, so large forests
+//stay in cache. Every feature value is an integer, so a numeric threshold t is stored as floor(t)
+//without changing any comparison; categories use codes of one dictionary shared by all trees, held
+//in the threshold while they are below CompactInlineCategories and in a category set otherwise.
+//Predictions are the same as the forest's for every input (see matches).
+//Built with shared subtrees, all trees form one graph in which every distinct subtree is stored
+//once (a split whose two subtrees are the same is dropped for that subtree), so nodes are shared
+//within and across trees; a split whose near child is already stored elsewhere gets a copy of
+//that child's nodes down to a leaf, which keeps one implicit child per node.
+class CompactForest {
+private:
+    std::vector<CompactNode> nodes;
+    std::vector<uint32_t> roots; //root node of every tree
+    std::vector<uint32_t> levels; //node levels on the longest path of every tree
+    std::vector<uint64_t> categorySets; //sets of the categorical splits with large codes, see CompactSetFlag
+    CategoryDictionary categories[NumFeatures];
+
+    using SetOffsets = std::map<std::vector<uint64_t>, int32_t>; //offset of every distinct set in categorySets
+
+    //Distinct subtrees found while building with shared subtrees, children first
+    struct SharedSubtree {
+        uint32_t packed; //feature and flag bits of the node
+        int32_t threshold;
+        int left, right; //ids of the children, -1 for leaves
+        uint32_t levels;
+        int64_t position; //first node holding the subtree, -1 until stored
+    };
+
+    struct SubtreeTable {
+        std::map<std::tuple<uint32_t, int32_t, int, int>, int> ids;
+        std::vector<SharedSubtree> subtrees;
+        SetOffsets sets;
+    };
+
+    static int32_t compactThreshold(double splitValue) {
+        double threshold = std::floor(splitValue);
+        if (!(threshold >= std::numeric_limits<int32_t>::min() && threshold < CompactMissing))
+            throw std::runtime_error("split threshold out of the compact range");
+        return (int32_t)threshold;
+    }
+
+    static bool compactLeafClass(const CompactNode& node) {
+        return (node.packed >> 3) & 1;
+    }
+
+    static bool swapped(const CompactNode& node) {
+        return (node.packed >> 4) & 1;
+    }
+
+    static int32_t farOffset(const CompactNode& node) {
+        return (int32_t)node.packed >> 5;
+    }
+
+    static const CompactNode* leftChild(const CompactNode* node) {
+        return swapped(*node) ? node + farOffset(*node) : node + 1;
+    }
+
+    static const CompactNode* rightChild(const CompactNode* node) {
+        return swapped(*node) ? node + 1 : node + farOffset(*node);
+    }
+
+    //Whether a categorical split with this threshold sends the code left; unseen codes (-1) go right
+    static bool inCategoryMask(const uint64_t* sets, int32_t threshold, int32_t code) {
+        if ((uint32_t)threshold & CompactSetFlag) return inCategorySet(sets, (int32_t)((uint32_t)threshold & ~CompactSetFlag), code);
+        return (uint32_t)code < (uint32_t)CompactInlineCategories && (((uint32_t)threshold >> code) & 1) != 0;
+    }
+
+    //Codes a categorical split with this threshold sends left, in increasing order
+    std::vector<int> leftCodes(int32_t threshold) const {
+        std::vector<int> codes;
+        int end = CompactInlineCategories;
+        if ((uint32_t)threshold & CompactSetFlag) end = 64 * (int)categorySets[(uint32_t)threshold & ~CompactSetFlag];
+        for (int code = 0; code < end; ++code) if (inCategoryMask(categorySets.data(), threshold, code)) codes.push_back(code);
+        return codes;
+    }
+
+    int32_t nodeThreshold(const DecisionTree& tree, const TreeNode& node, SetOffsets& sets) {
+        if (node.categorySet < 0) return compactThreshold(node.splitValue);
+        std::vector<int> codes;
+        for (int code : tree.leftCategories(node))
+            codes.push_back(categories[node.featureIdx].encode(tree.getCategories(node.featureIdx).decode(code)));
+        std::vector<uint64_t> bits = categoryBits(codes.data(), codes.size());
+        if (bits.size() <= 1 && (bits.empty() || bits[0] < (1ull << CompactInlineCategories))) return bits.empty() ? 0 : (int32_t)bits[0];
+        auto inserted = sets.emplace(bits, (int32_t)categorySets.size());
+        if (inserted.second) {
+            if (categorySets.size() + 1 + bits.size() > CompactSetFlag) throw std::runtime_error("category sets too large for compact nodes");
+            appendCategorySet(categorySets, bits);
+        }
+        return (int32_t)(CompactSetFlag | (uint32_t)inserted.first->second);
+    }
+
+    //Append the subtree at index of tree in preorder; returns its number of levels
+    uint32_t appendSubtree(const DecisionTree& tree, int32_t index, SetOffsets& sets) {
+        const TreeNode& node = tree.getNodes()[index];
+        size_t at = nodes.size();
+        nodes.push_back({ 0, 0 });
+        if (node.isLeaf) {
+            nodes[at].packed = CompactLeaf | (node.leafClass ? 8u : 0u);
+            return 1;
+        }
+        nodes[at].threshold = nodeThreshold(tree, node, sets);
+        nodes[at].packed = (uint32_t)node.featureIdx | (node.categorySet >= 0 ? 8u : 0u);
+        uint32_t leftLevels = appendSubtree(tree, node.left, sets);
+        size_t offset = nodes.size() - at;
+        if (offset > (size_t)CompactMaxOffset) throw std::runtime_error("tree too large for compact nodes");
+        nodes[at].packed |= (uint32_t)offset << 5;
+        uint32_t rightLevels = appendSubtree(tree, node.right, sets);
+        return 1 + std::max(leftLevels, rightLevels);
+    }
+
+    //Id of the subtree at index of tree in table, adding it and its children if they are new
+    int internSubtree(const DecisionTree& tree, int32_t index, SubtreeTable& table) {
+        const TreeNode& node = tree.getNodes()[index];
+        uint32_t packed = CompactLeaf | (node.leafClass ? 8u : 0u), levels = 1;
+        int32_t threshold = 0;
+        int left = -1, right = -1;
+        if (!node.isLeaf) {
+            left = internSubtree(tree, node.left, table);
+            right = internSubtree(tree, node.right, table);
+            if (left == right) return left; //both sides decide alike
+            packed = (uint32_t)node.featureIdx | (node.categorySet >= 0 ? 8u : 0u);
+            threshold = nodeThreshold(tree, node, table.sets);
+            levels = 1 + std::max(table.subtrees[left].levels, table.subtrees[right].levels);
+        }
+        auto inserted = table.ids.emplace(std::make_tuple(packed, threshold, left, right), (int)table.subtrees.size());
+        if (inserted.second) table.subtrees.push_back({ packed, threshold, left, right, levels, -1 });
+        return inserted.first->second;
+    }
+
+    //Append a copy of subtree id, its near child right behind it and its far child the stored copy
+    //if there is one (the left child is near unless only the left one is stored); returns the position
+    uint32_t placeSubtree(int id, SubtreeTable& table) {
+        const SharedSubtree subtree = table.subtrees[id];
+        uint32_t at = (uint32_t)nodes.size();
+        nodes.push_back({ subtree.threshold, subtree.packed });
+        if (table.subtrees[id].position < 0) table.subtrees[id].position = at;
+        if (subtree.left < 0) return at;
+        bool swap = table.subtrees[subtree.right].position < 0 && table.subtrees[subtree.left].position >= 0;
+        int near = swap ? subtree.right : subtree.left, far = swap ? subtree.left : subtree.right;
+        placeSubtree(near, table);
+        int64_t farPosition = table.subtrees[far].position >= 0 ? table.subtrees[far].position : placeSubtree(far, table);
+        int64_t offset = farPosition - at;
+        if (offset > CompactMaxOffset || offset < -CompactMaxOffset) throw std::runtime_error("forest too large for compact nodes");
+        nodes[at].packed |= (swap ? 16u : 0u) | ((uint32_t)offset << 5);
+        return at;
+    }
+
+    //Same decisions at every node for every integer input
+    bool sameSubtree(const DecisionTree& tree, int32_t index, const CompactNode* node) const {
+        const TreeNode& full = tree.getNodes()[index];
+        uint32_t feature = node->packed & 7;
+        if (full.isLeaf) return feature == CompactLeaf && compactLeafClass(*node) == full.leafClass;
+        if (feature != (uint32_t)full.featureIdx || ((node->packed & 8) != 0) != (full.categorySet >= 0)) return false;
+        if (full.categorySet >= 0) {
+            std::vector<std::string> compactLeft, fullLeft;
+            for (int code : leftCodes(node->threshold)) {
+                if (code >= categories[feature].size()) return false;
+                compactLeft.push_back(categories[feature].decode(code));
+            }
+            for (int code : tree.leftCategories(full)) fullLeft.push_back(tree.getCategories(feature).decode(code));
+            std::sort(compactLeft.begin(), compactLeft.end());
+            std::sort(fullLeft.begin(), fullLeft.end());
+            if (compactLeft != fullLeft) return false;
+        }
+        else if (node->threshold != std::floor(full.splitValue)) {
+            return false;
+        }
+        return sameDecisions(tree, full.left, leftChild(node)) && sameDecisions(tree, full.right, rightChild(node));
+    }
+
+    //As sameSubtree, also accepting a split of tree that was dropped because its two subtrees are the same
+    bool sameDecisions(const DecisionTree& tree, int32_t index, const CompactNode* node) const {
+        if (sameSubtree(tree, index, node)) return true;
+        const TreeNode& full = tree.getNodes()[index];
+        return !full.isLeaf && sameDecisions(tree, full.left, node) && sameDecisions(tree, full.right, node);
+    }
+
+    [[noreturn]] static void corrupt(const char* what) {
+        throw std::runtime_error(std::string("invalid compact model file: ") + what);
+    }
+
+    //Every node must be reachable from a root, children must be inside the node array, no path
+    //may loop and the stored depths must be exact, since batch inference walks that many levels
+    void checkNodes() const {
+        std::vector<uint32_t> height(nodes.size(), 0); //levels of the subtree at a node, 0 until known
+        std::vector<char> entered(nodes.size(), 0);
+        std::vector<uint32_t> stack;
+        for (size_t t = 0; t < roots.size(); ++t) {
+            if (roots[t] >= nodes.size()) corrupt("tree out of range");
+            stack.push_back(roots[t]);
+            while (!stack.empty()) {
+                uint32_t i = stack.back();
+                if (height[i] != 0) {
+                    stack.pop_back();
+                    continue;
+                }
+                uint32_t feature = nodes[i].packed & 7;
+                if (feature == CompactLeaf) {
+                    height[i] = 1;
+                    continue;
+                }
+                int64_t far = (int64_t)i + farOffset(nodes[i]);
+                if (i + 1 >= nodes.size() || far < 0 || far >= (int64_t)nodes.size() || far == i) corrupt("child offset out of range");
+                uint32_t children[2] = { i + 1, (uint32_t)far };
+                if (entered[i]) {
+                    height[i] = 1 + std::max(height[children[0]], height[children[1]]);
+                    continue;
+                }
+                entered[i] = 1;
+                if (feature >= (uint32_t)NumFeatures) corrupt("feature index out of range");
+                bool categorical = (nodes[i].packed & 8) != 0;
+                if (categorical != isCategoricalFeature(feature)) corrupt("split kind does not match the feature");
+                if (categorical) {
+                    uint32_t at = (uint32_t)nodes[i].threshold & ~CompactSetFlag;
+                    if (((uint32_t)nodes[i].threshold & CompactSetFlag) && (at >= categorySets.size() || categorySets[at] > categorySets.size() - at - 1))
+                        corrupt("category set out of range");
+                    std::vector<int> codes = leftCodes(nodes[i].threshold);
+                    if (!codes.empty() && codes.back() >= categories[feature].size()) corrupt("category code out of range");
+                }
+                for (uint32_t child : children) {
+                    if (entered[child] && height[child] == 0) corrupt("loop in the node graph");
+                    if (height[child] == 0) stack.push_back(child);
+                }
+            }
+            if (height[roots[t]] != levels[t]) corrupt("wrong tree depth");
+        }
+        for (uint32_t h : height) if (h == 0) corrupt("unreachable node");
+    }
+
+    static bool walk(const CompactNode* node, const uint64_t* sets, const int32_t* row) {
+        while (true) {
+            uint32_t feature = node->packed & 7;
+            if (feature == CompactLeaf) return compactLeafClass(*node);
+            int32_t value = row[feature];
+            bool goLeft = (node->packed & 8) ? inCategoryMask(sets, node->threshold, value) : value <= node->threshold;
+            node += goLeft != swapped(*node) ? 1 : farOffset(*node);
+        }
+    }
+
+    //Batch walk as DecisionTree::walkBlock; columns[CompactLeaf] is a column of zeros. Only splits on
+    //category sets leave the branch-free step.
+    static void walkBlock(const CompactNode* tree, const uint64_t* sets, const int32_t* const* columns, int count, int levels, int32_t* cursor, int* votes) {
+        std::fill(cursor, cursor + count, 0);
+        for (int level = 1; level < levels; ++level) {
+            for (int r = 0; r < count; ++r) {
+                int32_t at = cursor[r];
+                uint32_t packed = tree[at].packed;
+                int32_t threshold = tree[at].threshold;
+                uint32_t feature = packed & 7;
+                int32_t value = columns[feature][r];
+                uint32_t categorical = (packed >> 3) & 1;
+                uint32_t inMask = ((uint32_t)threshold >> (value & 31)) & ((uint32_t)value < (uint32_t)CompactInlineCategories);
+                if (categorical && ((uint32_t)threshold & CompactSetFlag)) inMask = inCategoryMask(sets, threshold, value);
+                uint32_t goLeft = (categorical & inMask) | ((categorical ^ 1) & (value <= threshold));
+                int32_t step = goLeft != ((packed >> 4) & 1) ? 1 : (int32_t)packed >> 5;
+                cursor[r] = at + (feature == CompactLeaf ? 0 : step);
+            }
+        }
+        for (int r = 0; r < count; ++r) votes[r] += compactLeafClass(tree[cursor[r]]) ? 1 : 0;
+    }
+
+    void encodeRow(const Passenger& p, int32_t* row) const {
+        row[PClass] = p.pclass;
+        row[Sex] = categories[Sex].find(p.sex);
+        row[Age] = isMissingValue(Age, p.age) ? CompactMissing : p.age;
+        row[SibSp] = p.sibSp;
+        row[Parch] = p.parch;
+        row[Fare] = isMissingValue(Fare, p.fare) ? CompactMissing : p.fare;
+        row[Embarked] = categories[Embarked].find(p.embarked);
+        row[CompactLeaf] = 0;
+    }
+
+public:
+    //shareSubtrees stores every distinct subtree once (see the class comment); otherwise every tree
+    //is stored whole in preorder. Throws std::runtime_error if a numeric threshold is outside the
+    //int32 range, a child is more than CompactMaxOffset nodes away or the forest is not of the
+    //Titanic schema; untrained trees become a single leaf voting not survived.
+    explicit CompactForest(const RandomForest& forest, bool shareSubtrees = false) {
+        if (!forest.schema()->isTitanic()) throw std::runtime_error("compact forests hold the Titanic schema only");
+        if (shareSubtrees) {
+            SubtreeTable table;
+            table.subtrees.push_back({ CompactLeaf, 0, -1, -1, 1, -1 }); //leaf of untrained trees
+            table.ids.emplace(std::make_tuple(CompactLeaf, 0, -1, -1), 0);
+            std::vector<int> treeIds;
+            for (const DecisionTree& tree : forest.getTrees())
+                treeIds.push_back(tree.getNodes().empty() ? 0 : internSubtree(tree, 0, table));
+            for (int id : treeIds) {
+                int64_t position = table.subtrees[id].position;
+                roots.push_back(position >= 0 ? (uint32_t)position : placeSubtree(id, table));
+                levels.push_back(table.subtrees[id].levels);
+            }
+            return;
+        }
+        SetOffsets sets;
+        for (const DecisionTree& tree : forest.getTrees()) {
+            roots.push_back((uint32_t)nodes.size());
+            if (tree.getNodes().empty()) {
+                nodes.push_back({ 0, CompactLeaf });
+                levels.push_back(1);
+            }
+            else {
+                levels.push_back(appendSubtree(tree, 0, sets));
+            }
+        }
+    }
+
+    //Load a file written by save; throws std::runtime_error if it is not a valid compact model
+    explicit CompactForest(const std::string& model_file) {
+        std::ifstream in(model_file, std::ios::binary);
+        if (!in.is_open()) throw std::runtime_error("cannot open " + model_file);
+        CompactFileHeader header;
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) corrupt("too small");
+        if (std::memcmp(header.magic, CompactFileMagic, sizeof(CompactFileMagic)) != 0) corrupt("bad magic");
+        if (header.byteOrder != ModelFileByteOrder) corrupt("written with a different byte order");
+        if (header.version != CompactFileVersion) corrupt("unsupported version");
+        if (header.nodeSize != sizeof(CompactNode) || header.featureCount != NumFeatures) corrupt("incompatible node layout");
+        in.seekg(0, std::ios::end);
+        uint64_t fileSize = (uint64_t)in.tellg();
+        if ((uint64_t)header.treeCount * 8 + (uint64_t)header.nodeCount * sizeof(CompactNode) > fileSize - sizeof(header)) corrupt("truncated");
+        in.seekg(sizeof(header));
+
+        roots.resize(header.treeCount);
+        levels.resize(header.treeCount);
+        nodes.resize(header.nodeCount);
+        in.read(reinterpret_cast<char*>(roots.data()), roots.size() * sizeof(uint32_t));
+        in.read(reinterpret_cast<char*>(levels.data()), levels.size() * sizeof(uint32_t));
+        in.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(CompactNode));
+        for (CategoryDictionary& dictionary : categories) {
+            uint32_t count = 0;
+            if (!in.read(reinterpret_cast<char*>(&count), sizeof(count))) corrupt("truncated category table");
+            for (uint32_t code = 0; code < count; ++code) {
+                uint32_t length = 0;
+                if (!in.read(reinterpret_cast<char*>(&length), sizeof(length)) || length > fileSize) corrupt("truncated category table");
+                std::string category(length, '\0');
+                if (!in.read(&category[0], length)) corrupt("truncated category table");
+                dictionary.encode(category);
+            }
+        }
+        uint64_t words = 0;
+        if (!in.read(reinterpret_cast<char*>(&words), sizeof(words)) || words > fileSize / sizeof(uint64_t)) corrupt("truncated category sets");
+        categorySets.resize(words);
+        if (!in.read(reinterpret_cast<char*>(categorySets.data()), words * sizeof(uint64_t))) corrupt("truncated category sets");
+        checkNodes();
+    }
+
+    //Throws std::runtime_error if the file cannot be written
+    void save(const std::string& model_file) const {
+        std::ofstream out(model_file, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot write " + model_file);
+        CompactFileHeader header = {};
+        std::memcpy(header.magic, CompactFileMagic, sizeof(CompactFileMagic));
+        header.version = CompactFileVersion;
+        header.byteOrder = ModelFileByteOrder;
+        header.nodeSize = sizeof(CompactNode);
+        header.featureCount = NumFeatures;
+        header.treeCount = (uint32_t)roots.size();
+        header.nodeCount = (uint32_t)nodes.size();
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(roots.data()), roots.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(levels.data()), levels.size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(CompactNode));
+        for (const CategoryDictionary& dictionary : categories) {
+            uint32_t count = (uint32_t)dictionary.size();
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            for (int code = 0; code < dictionary.size(); ++code) {
+                const std::string& category = dictionary.decode(code);
+                uint32_t length = (uint32_t)category.size();
+                out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                out.write(category.data(), length);
+            }
+        }
+        uint64_t words = categorySets.size();
+        out.write(reinterpret_cast<const char*>(&words), sizeof(words));
+        out.write(reinterpret_cast<const char*>(categorySets.data()), words * sizeof(uint64_t));
+        if (!out) throw std::runtime_error("cannot write " + model_file);
+    }
+
+    //True if every tree makes the same decisions as the corresponding tree of forest, node by
+    //node (up to dropped splits whose subtrees are the same), for every input; a check of the
+    //conversion or of a loaded file against its source
+    bool matches(const RandomForest& forest) const {
+        const std::vector<DecisionTree>& trees = forest.getTrees();
+        if (trees.size() != roots.size()) return false;
+        for (size_t t = 0; t < trees.size(); ++t) {
+            const CompactNode* root = nodes.data() + roots[t];
+            if (trees[t].getNodes().empty()) {
+                if ((root->packed & 7) != CompactLeaf || compactLeafClass(*root)) return false;
+            }
+            else if (!sameDecisions(trees[t], 0, root)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t treeCount() const {
+        return roots.size();
+    }
+
+    size_t nodeCount() const {
+        return nodes.size();
+    }
+
+    //Bytes of node storage
+    size_t nodeBytes() const {
+        return nodes.size() * sizeof(CompactNode);
+    }
+
+    //Majority vote, stopping once the remaining trees cannot change it (as RandomForest::predict)
+    bool predict(const Passenger& p) const {
+        int32_t row[CompactLeaf + 1];
+        encodeRow(p, row);
+        int votes0 = 0, votes1 = 0;
+        int remaining = (int)roots.size();
+        for (uint32_t root : roots) {
+            if (walk(nodes.data() + root, categorySets.data(), row)) ++votes1;
+            else ++votes0;
+            --remaining;
+            if (votes1 > votes0 + remaining || votes0 >= votes1 + remaining) break;
+        }
+        return votes1 > votes0;
+    }
+
+    //Fraction of trees voting survived for every row, scored tree-major like RandomForest::predictBatch
+    std::vector<double> predictBatch(const Dataset& rows, int nThreads = 1) const {
+        constexpr int BatchBlockSize = 256;
+        size_t n = rows.size();
+        std::vector<int> votes(n, 0);
+        if (n == 0 || roots.empty()) return std::vector<double>(n, 0.0);
+
+        std::vector<int> categoryCodes[NumFeatures];
+        for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+            if (!isCategoricalFeature(featureIdx)) continue;
+            const CategoryDictionary& dictionary = rows.dictionary(featureIdx);
+            for (int code = 0; code < dictionary.size(); ++code)
+                categoryCodes[featureIdx].push_back(categories[featureIdx].find(dictionary.decode(code)));
+        }
+
+        size_t nBlocks = (n + BatchBlockSize - 1) / BatchBlockSize;
+        ThreadPool pool(nThreads);
+        int nTasks = (int)std::min<size_t>(nBlocks, (size_t)pool.threadCount() * 4);
+        pool.parallelFor(nTasks, [&](int task) {
+            std::vector<int32_t> block((CompactLeaf + 1) * BatchBlockSize, 0);
+            std::vector<int32_t> cursor(BatchBlockSize);
+            const int32_t* columns[CompactLeaf + 1];
+            for (uint32_t featureIdx = 0; featureIdx <= CompactLeaf; ++featureIdx) columns[featureIdx] = block.data() + featureIdx * BatchBlockSize;
+            for (size_t b = nBlocks * task / nTasks; b < nBlocks * (task + 1) / nTasks; ++b) {
+                size_t begin = b * BatchBlockSize;
+                int count = (int)std::min<size_t>(BatchBlockSize, n - begin);
+                for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+                    const int* column = rows.column(featureIdx).data() + begin;
+                    int32_t* values = block.data() + featureIdx * BatchBlockSize;
+                    if (isCategoricalFeature(featureIdx)) {
+                        for (int r = 0; r < count; ++r) values[r] = categoryCodes[featureIdx][column[r]];
+                    }
+                    else {
+                        for (int r = 0; r < count; ++r) values[r] = isMissingValue(featureIdx, column[r]) ? CompactMissing : column[r];
+                    }
+                }
+                for (size_t t = 0; t < roots.size(); ++t)
+                    walkBlock(nodes.data() + roots[t], categorySets.data(), columns, count, (int)levels[t], cursor.data(), votes.data() + begin);
+            }
+        });
+
+        std::vector<double> probabilities(n);
+        for (size_t i = 0; i < n; ++i) probabilities[i] = (double)votes[i] / roots.size();
+        return probabilities;
+    }
+
+    double evaluate(const Dataset& testData, int nThreads = 1) const {
+        std::vector<double> probabilities = predictBatch(testData, nThreads);
+        int correct = 0;
+        for (size_t i = 0; i < probabilities.size(); ++i) {
+            if ((probabilities[i] > 0.5) == (testData.label()[i] == 1)) ++correct;
+        }
+        return static_cast<double>(correct) / testData.size();
+    }
+};
@@ -0,0 +1,40 @@
+// Command line front end of ForestCompiler:
+//   CompileForest <forest_model.bin> <output.h> [namespace]
+// reads a forest written by RandomForest::save and writes the generated C++ source.
+#include "ForestCompiler.h"
+#include <fstream>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <forest_model.bin> <output.h> [namespace]\n";
+        return 1;
+    }
+    std::string modelFile = argv[1];
+    std::string outputFile = argv[2];
+    std::string ns = argc > 3 ? argv[3] : "forest_model";
+
+    std::ifstream probe(modelFile, std::ios::binary);
+    if (!probe.is_open()) {
+        std::cerr << "File not found\n";
+        return 1;
+    }
+    probe.close();
+
+    RandomForest forest;
+    try {
+        forest.load(modelFile);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+
+    std::ofstream out(outputFile);
+    if (!out.is_open()) {
+        std::cerr << "Cannot write " << outputFile << "\n";
+        return 1;
+    }
+    ForestCompiler(forest).generate(out, ns, modelFile);
+    std::cout << "Compiled " << forest.getTrees().size() << " trees into " << outputFile << "\n";
+    return 0;
+}
@@ -0,0 +1,120 @@
+// Check that the code generated by ForestCompiler predicts what RandomForest::predict does:
+//   CompiledForestTest [titanic.csv]
+// Trains a forest, compiles it with the C++ compiler named by $CXX (c++ if unset), runs the result over
+// the passengers plus a few with unseen categories and missing values, and compares every answer.
+// Prints the differences and returns 1 if there are any.
+#include "ForestCompiler.h"
+#include <cstdlib>
+
+static std::vector<Passenger> loadPassengers(const std::string& path) {
+    std::ifstream file(path);
+    if (!file.is_open()) throw std::runtime_error("cannot open " + path);
+    std::string line;
+    std::vector<Passenger> data;
+    std::getline(file, line); // skip header
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        bool inQuotes = false;
+        std::string field;
+        for (char c : line) {
+            if (c == '"') inQuotes = !inQuotes;
+            else if (c == ',' && !inQuotes) {
+                fields.push_back(field);
+                field.clear();
+            }
+            else field += c;
+        }
+        fields.push_back(field);
+        if (fields.size() >= 12) data.emplace_back(fields);
+    }
+    return data;
+}
+
+//Reads pclass,sex,age,sibSp,parch,fare,embarked lines and prints the generated model's answer to each
+static const char* driverSource = R"(#include "compiled_forest_test.h"
+#include <iostream>
+#include <sstream>
+
+struct Row {
+    int pclass;
+    std::string sex;
+    int age, sibSp, parch, fare;
+    std::string embarked;
+};
+
+int main() {
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream in(line);
+        std::string fields[7];
+        for (std::string& field : fields) std::getline(in, field, ',');
+        Row p{ std::stoi(fields[0]), fields[1], std::stoi(fields[2]), std::stoi(fields[3]), std::stoi(fields[4]), std::stoi(fields[5]), fields[6] };
+        std::cout << compiled_forest_test::predict(p) << "\n";
+    }
+}
+)";
+
+int main(int argc, char* argv[]) {
+    std::string dataFile = argc > 1 ? argv[1] : "titanic.csv";
+    std::string modelFile = "compiled_forest_test.bin", header = "compiled_forest_test.h", driver = "compiled_forest_test.cpp";
+    std::string program = "./compiled_forest_test", rowsFile = "compiled_forest_test.in", answersFile = "compiled_forest_test.out";
+    int failures = 0;
+    try {
+        std::vector<Passenger> passengers = loadPassengers(dataFile);
+        Passenger unusual = passengers.front();
+        for (const char* sex : { "male", "female", "unknown" }) {
+            for (const char* embarked : { "S", "C", "", "X" }) {
+                for (int age : { -1, 30 }) {
+                    unusual.sex = sex;
+                    unusual.embarked = embarked;
+                    unusual.age = age;
+                    unusual.fare = age < 0 ? 12 : -1;
+                    passengers.push_back(unusual);
+                }
+            }
+        }
+
+        RandomForest forest(30, 6, 2, 1, 0.7, 0, 1, 42);
+        forest.train(passengers);
+        forest.save(modelFile);
+        RandomForest loaded;
+        loaded.load(modelFile);
+
+        std::ofstream generated(header);
+        ForestCompiler(loaded).generate(generated, "compiled_forest_test", modelFile);
+        generated.close();
+        std::ofstream(driver) << driverSource;
+        std::ofstream rows(rowsFile);
+        for (const Passenger& p : passengers)
+            rows << p.pclass << ',' << p.sex << ',' << p.age << ',' << p.sibSp << ',' << p.parch << ',' << p.fare << ',' << p.embarked << "\n";
+        rows.close();
+
+        const char* cxx = std::getenv("CXX");
+        std::string compile = std::string(cxx ? cxx : "c++") + " -std=c++17 -O1 " + driver + " -o " + program;
+        if (std::system(compile.c_str()) != 0) throw std::runtime_error("cannot compile the generated model: " + compile);
+        std::string run = program + " < " + rowsFile + " > " + answersFile;
+        if (std::system(run.c_str()) != 0) throw std::runtime_error("generated model failed: " + run);
+
+        std::ifstream answers(answersFile);
+        std::string answer;
+        size_t i = 0;
+        for (; i < passengers.size() && std::getline(answers, answer); ++i) {
+            bool expected = forest.predict(passengers[i]);
+            if (loaded.predict(passengers[i]) != expected || answer != (expected ? "1" : "0")) {
+                std::cerr << "row " << i << ": compiled " << answer << ", forest " << expected << ", loaded forest " << loaded.predict(passengers[i]) << "\n";
+                ++failures;
+            }
+        }
+        if (i != passengers.size()) {
+            std::cerr << "generated model answered " << i << " of " << passengers.size() << " rows\n";
+            ++failures;
+        }
+        std::cout << passengers.size() << " rows compared, " << failures << " differences" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        ++failures;
+    }
+    for (const std::string& file : { modelFile, header, driver, program, rowsFile, answersFile }) std::remove(file.c_str());
+    return failures == 0 ? 0 : 1;
+}
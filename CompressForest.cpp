@@ -0,0 +1,44 @@
+// Post-training compression of a forest written by RandomForest::save:
+//   CompressForest <forest_model.bin> <output.bin> [output.rfc]
+// collapses splits whose subtrees predict one class and writes the smaller forest; with a third
+// argument also writes a CompactForest in which identical subtrees are stored once.
+// Predictions of both outputs are the same as the input's.
+#include "CompactForest.h"
+#include <fstream>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <forest_model.bin> <output.bin> [output.rfc]\n";
+        return 1;
+    }
+    std::string modelFile = argv[1];
+    std::string outputFile = argv[2];
+
+    std::ifstream probe(modelFile, std::ios::binary);
+    if (!probe.is_open()) {
+        std::cerr << "File not found\n";
+        return 1;
+    }
+    probe.close();
+
+    try {
+        RandomForest forest;
+        forest.load(modelFile);
+        size_t nodes = forest.nodeCount();
+        size_t removed = forest.collapseRedundantSplits();
+        forest.save(outputFile);
+        std::cout << forest.getTrees().size() << " trees, " << nodes << " nodes; " << removed
+            << " in redundant splits removed, " << nodes - removed << " written to " << outputFile << "\n";
+        if (argc > 3) {
+            CompactForest compact(forest, true);
+            compact.save(argv[3]);
+            std::cout << compact.nodeCount() << " nodes with shared subtrees ("
+                << 100.0 * compact.nodeCount() / std::max<size_t>(nodes, 1) << "%) written to " << argv[3] << "\n";
+        }
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
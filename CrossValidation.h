@@ -0,0 +1,172 @@
+#pragma once
+
+#include <chrono>
+#include <cmath>
+#include <map>
+#include <tuple>
+
+#include "RandomForest.h"
+
+//Hyperparameters of one forest of a search (see RandomForest's constructor)
+struct ForestParams {
+    int nTrees = 100;
+    int maxDepth = 5;
+    int minSamplesSplit = 2;
+    int minSamplesLeaf = 1;
+    double featureSampleRatio = 1.0;
+    int maxBins = 0;
+    bool extraTrees = false;
+};
+
+//Values of a grid search; configurations() combines every value of every parameter
+struct ParamGrid {
+    std::vector<int> nTrees{ 100 };
+    std::vector<int> maxDepth{ 5 };
+    std::vector<int> minSamplesSplit{ 2 };
+    std::vector<int> minSamplesLeaf{ 1 };
+    std::vector<double> featureSampleRatio{ 1.0 };
+    std::vector<int> maxBins{ 0 };
+    std::vector<bool> extraTrees{ false };
+
+    std::vector<ForestParams> configurations() const {
+        std::vector<ForestParams> result;
+        for (bool extra : extraTrees)
+            for (int bins : maxBins)
+                for (double ratio : featureSampleRatio)
+                    for (int leaf : minSamplesLeaf)
+                        for (int split : minSamplesSplit)
+                            for (int depth : maxDepth)
+                                for (int trees : nTrees) result.push_back({ trees, depth, split, leaf, ratio, bins, extra });
+        return result;
+    }
+};
+
+//Cross-validated score of one configuration
+struct CrossValidationScore {
+    ForestParams params;
+    std::vector<double> foldAccuracy; //on the held-out rows of each fold
+    double accuracy = 0.0; //mean of foldAccuracy
+    double accuracyStdDev = 0.0; //sample standard deviation of foldAccuracy
+    double trainSeconds = 0.0; //training time of its forests, summed over the folds
+    double evaluateSeconds = 0.0; //time to score the held-out rows, summed over the folds
+};
+
+//k-fold cross-validation of forest configurations on one dataset, which must outlive it.
+//The rows are dealt once into folds stratified by label, and the data is presorted once: every
+//forest trains on its folds' rows of the shared data and presort (see RandomForest::addTrees),
+//so no rows are copied or sorted again. Configurations that differ only in nTrees share their
+//forests: for every fold the largest is grown in steps, the held-out rows being scored after
+//each step with the votes of the trees so far kept, and the times of a configuration include
+//the trees it shares with smaller ones. Each (fold, group of such configurations) is one job;
+//jobs run in parallel on nThreads, each forest training serially. A given seed gives the same
+//scores at any thread count, and the forest of a configuration on a fold is the one
+//RandomForest(params..., seed) would train on the fold's rows.
+class CrossValidation {
+private:
+    const Dataset& data;
+    int nFolds;
+    unsigned seed;
+    int nThreads;
+    std::vector<std::vector<int>> sorted; //DecisionTree::presortFeatures(data)
+    std::vector<std::vector<int>> trainRows, testRows; //per fold, ascending
+
+public:
+    //nThreads <= 0 uses every hardware thread.
+    //Throws std::invalid_argument if nFolds < 2 or the data has fewer rows than folds.
+    CrossValidation(const Dataset& data, int nFolds = 5, unsigned seed = 42, int nThreads = 0) :
+        data(data), nFolds(nFolds), seed(seed), nThreads(nThreads) {
+        if (nFolds < 2 || data.size() < (size_t)nFolds) throw std::invalid_argument("cross-validation needs at least 2 folds of rows");
+        std::vector<int> order(data.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::mt19937 rng(seed);
+        std::shuffle(order.begin(), order.end(), rng);
+        std::stable_partition(order.begin(), order.end(), [&](int idx) { return data.label()[idx] == 0; });
+        std::vector<int> foldOf(data.size());
+        for (size_t i = 0; i < order.size(); ++i) foldOf[order[i]] = (int)(i % nFolds);
+
+        trainRows.resize(nFolds);
+        testRows.resize(nFolds);
+        for (int idx = 0; idx < (int)data.size(); ++idx) {
+            for (int fold = 0; fold < nFolds; ++fold) (fold == foldOf[idx] ? testRows : trainRows)[fold].push_back(idx);
+        }
+        sorted = DecisionTree::presortFeatures(data);
+    }
+
+    int foldCount() const {
+        return nFolds;
+    }
+
+    //Score of every configuration, in the given order
+    std::vector<CrossValidationScore> evaluate(const std::vector<ForestParams>& configurations) const {
+        //configurations that differ only in nTrees, by ascending nTrees
+        std::map<std::tuple<int, int, int, double, int, bool>, std::vector<int>> groupOf;
+        for (int c = 0; c < (int)configurations.size(); ++c) {
+            const ForestParams& p = configurations[c];
+            groupOf[{ p.maxDepth, p.minSamplesSplit, p.minSamplesLeaf, p.featureSampleRatio, p.maxBins, p.extraTrees }].push_back(c);
+        }
+        std::vector<std::vector<int>> groups;
+        for (auto& [key, group] : groupOf) {
+            std::stable_sort(group.begin(), group.end(), [&](int a, int b) { return configurations[a].nTrees < configurations[b].nTrees; });
+            groups.push_back(group);
+        }
+
+        std::vector<CrossValidationScore> scores(configurations.size());
+        std::vector<double> trainSeconds(configurations.size() * nFolds), evaluateSeconds(configurations.size() * nFolds);
+        for (int c = 0; c < (int)configurations.size(); ++c) {
+            scores[c].params = configurations[c];
+            scores[c].foldAccuracy.assign(nFolds, 0.0);
+        }
+        ThreadPool pool(nThreads);
+        pool.parallelFor((int)groups.size() * nFolds, [&](int job) {
+            const std::vector<int>& group = groups[job / nFolds];
+            int fold = job % nFolds;
+            const ForestParams& p = configurations[group[0]];
+            RandomForest forest(0, p.maxDepth, p.minSamplesSplit, p.minSamplesLeaf, p.featureSampleRatio, p.maxBins, 1, seed, p.extraTrees);
+            const std::vector<int>& test = testRows[fold];
+            std::vector<int> votes(test.size(), 0);
+            double trained = 0.0, evaluated = 0.0;
+            for (int c : group) {
+                size_t first = forest.getTrees().size();
+                auto start = std::chrono::steady_clock::now();
+                forest.addTrees(data, trainRows[fold], sorted, configurations[c].nTrees - (int)first);
+                auto grown = std::chrono::steady_clock::now();
+                const std::vector<DecisionTree>& trees = forest.getTrees();
+                int correct = 0;
+                for (size_t i = 0; i < test.size(); ++i) {
+                    for (size_t t = first; t < trees.size(); ++t) votes[i] += trees[t].predict(data, test[i]);
+                    if ((votes[i] > (int)trees.size() - votes[i]) == (data.label()[test[i]] == 1)) ++correct;
+                }
+                auto scored = std::chrono::steady_clock::now();
+                trained += std::chrono::duration<double>(grown - start).count();
+                evaluated += std::chrono::duration<double>(scored - grown).count();
+                scores[c].foldAccuracy[fold] = (double)correct / test.size();
+                trainSeconds[c * nFolds + fold] = trained;
+                evaluateSeconds[c * nFolds + fold] = evaluated;
+            }
+        });
+
+        for (int c = 0; c < (int)configurations.size(); ++c) {
+            CrossValidationScore& score = scores[c];
+            double sum = 0.0, squares = 0.0;
+            for (int fold = 0; fold < nFolds; ++fold) {
+                sum += score.foldAccuracy[fold];
+                score.trainSeconds += trainSeconds[c * nFolds + fold];
+                score.evaluateSeconds += evaluateSeconds[c * nFolds + fold];
+            }
+            score.accuracy = sum / nFolds;
+            for (double accuracy : score.foldAccuracy) squares += (accuracy - score.accuracy) * (accuracy - score.accuracy);
+            score.accuracyStdDev = std::sqrt(squares / (nFolds - 1));
+        }
+        return scores;
+    }
+
+    std::vector<CrossValidationScore> evaluate(const ParamGrid& grid) const {
+        return evaluate(grid.configurations());
+    }
+
+    //Best mean accuracy first; ties keep their order
+    static void sortByAccuracy(std::vector<CrossValidationScore>& scores) {
+        std::stable_sort(scores.begin(), scores.end(),
+            [](const CrossValidationScore& a, const CrossValidationScore& b) { return a.accuracy > b.accuracy; });
+    }
+};
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Dataset.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+//Loads the passengers csv, or any csv described by a FeatureSchema, straight into a columnar Dataset.
+//The file is memory-mapped and cut into chunks at record boundaries; chunks are parsed in
+//parallel into typed columns and then concatenated in file order, so the result (category
+//codes included) does not depend on the thread count. Fields are read in place; quoted
+//fields may contain commas and newlines. Passenger values are interpreted as in Passenger's constructor.
+class CsvLoader {
+private:
+    static constexpr int FieldCount = 12; //PassengerId ... Embarked
+    static constexpr size_t MinChunkBytes = 1 << 20;
+
+    //Like std::stoi: leading whitespace and a sign are accepted, parsing stops at the first
+    //non-digit ("7.25" is 7); false if there are no digits or the value does not fit
+    static bool parseInt(std::string_view field, int& value) {
+        size_t i = 0;
+        while (i < field.size() && std::isspace((unsigned char)field[i])) ++i;
+        if (i < field.size() && field[i] == '+') {
+            ++i;
+            if (i < field.size() && field[i] == '-') return false;
+        }
+        auto result = std::from_chars(field.data() + i, field.data() + field.size(), value);
+        return result.ec == std::errc();
+    }
+
+    static int requiredInt(std::string_view field, const char* column) {
+        int value = 0;
+        if (!parseInt(field, value)) throw std::runtime_error(std::string("invalid ") + column + " value: " + std::string(field));
+        return value;
+    }
+
+    //A number with at most decimals fraction digits (more only if they are zeros), times 10^decimals:
+    //"7.25" with 2 decimals is 725. Surrounding whitespace and a sign are accepted; false if the
+    //field has anything else or the value does not fit an int
+    static bool parseFixed(std::string_view field, int decimals, int& value) {
+        size_t begin = 0, end = field.size();
+        while (begin < end && std::isspace((unsigned char)field[begin])) ++begin;
+        while (end > begin && std::isspace((unsigned char)field[end - 1])) --end;
+        bool negative = begin < end && field[begin] == '-';
+        if (begin < end && (field[begin] == '-' || field[begin] == '+')) ++begin;
+        constexpr int64_t Limit = (int64_t)std::numeric_limits<int>::max() + 1;
+        int64_t magnitude = 0;
+        int digits = 0, fractionDigits = -1; //-1 before the decimal point
+        for (size_t i = begin; i < end; ++i) {
+            if (field[i] == '.' && fractionDigits < 0) {
+                fractionDigits = 0;
+                continue;
+            }
+            if (field[i] < '0' || field[i] > '9') return false;
+            ++digits;
+            if (fractionDigits >= 0 && ++fractionDigits > decimals) {
+                if (field[i] != '0') return false;
+                continue;
+            }
+            magnitude = magnitude * 10 + (field[i] - '0');
+            if (magnitude > Limit) return false;
+        }
+        if (digits == 0) return false;
+        for (int kept = std::max(fractionDigits, 0); kept < decimals; ++kept) {
+            magnitude *= 10;
+            if (magnitude > Limit) return false;
+        }
+        if (magnitude == Limit && !negative) return false;
+        value = (int)(negative ? -magnitude : magnitude);
+        return true;
+    }
+
+    //Age and fare: -1 if empty or not a number
+    static int optionalInt(std::string_view field) {
+        int value = -1;
+        if (field.empty() || !parseInt(field, value)) return -1;
+        return value;
+    }
+
+    //Call onField(column, begin, end, quoted) for every field of the record at position, where
+    //[begin, end) is the field's text and quoted tells that it has quotes to drop; returns the
+    //position of the next record
+    template <typename OnField>
+    static size_t scanRecord(std::string_view text, size_t position, OnField onField) {
+        int column = 0;
+        size_t fieldStart = position;
+        bool inQuotes = false, quoted = false;
+        while (position < text.size()) {
+            char c = text[position++];
+            if (c == '"') {
+                inQuotes = !inQuotes;
+                quoted = true;
+            }
+            else if (!inQuotes && (c == ',' || c == '\n')) {
+                size_t fieldEnd = position - 1;
+                if (c == '\n' && fieldEnd > fieldStart && text[fieldEnd - 1] == '\r') --fieldEnd;
+                onField(column++, fieldStart, fieldEnd, quoted);
+                quoted = false;
+                fieldStart = position;
+                if (c == '\n') return position;
+            }
+        }
+        size_t fieldEnd = position;
+        if (fieldEnd > fieldStart && text[fieldEnd - 1] == '\r') --fieldEnd;
+        onField(column, fieldStart, fieldEnd, quoted);
+        return position;
+    }
+
+    static std::string_view unquote(std::string_view field, bool quoted, std::string& buffer) {
+        if (!quoted) return field;
+        buffer.clear();
+        for (char c : field) if (c != '"') buffer += c;
+        return buffer;
+    }
+
+    //Parse the records of text from dataStart on with parse(records, chunk), in parallel chunks
+    //of datasets of the given schema, and concatenate them in file order
+    template <typename ParseRecords>
+    static Dataset parseChunks(std::string_view text, size_t dataStart, const std::shared_ptr<const FeatureSchema>& schema,
+        int nThreads, ParseRecords parse) {
+        ThreadPool pool(nThreads);
+        size_t bytes = text.size() - dataStart;
+        int nChunks = (int)std::max<size_t>(1, std::min<size_t>((size_t)pool.threadCount() * 4, bytes / MinChunkBytes));
+
+        //quote parity of every slice tells whether its first byte is inside a quoted field
+        std::vector<size_t> sliceStart(nChunks + 1);
+        for (int i = 0; i <= nChunks; ++i) sliceStart[i] = dataStart + bytes * i / nChunks;
+        std::vector<char> oddQuotes(nChunks, 0);
+        pool.parallelFor(nChunks, [&](int i) {
+            size_t quotes = std::count(text.begin() + sliceStart[i], text.begin() + sliceStart[i + 1], '"');
+            oddQuotes[i] = quotes % 2;
+        });
+
+        //move every slice start forward to the next record boundary
+        std::vector<size_t> chunkStart(nChunks + 1);
+        chunkStart[0] = dataStart;
+        chunkStart[nChunks] = text.size();
+        bool inQuotes = false;
+        for (int i = 1; i < nChunks; ++i) {
+            inQuotes = inQuotes != (oddQuotes[i - 1] != 0);
+            chunkStart[i] = std::max(chunkStart[i - 1], nextRecord(text, sliceStart[i], inQuotes));
+        }
+
+        std::vector<Dataset> chunks(nChunks, Dataset(schema));
+        pool.parallelFor(nChunks, [&](int i) {
+            parse(text.substr(chunkStart[i], chunkStart[i + 1] - chunkStart[i]), chunks[i]);
+        });
+
+        Dataset data(schema);
+        size_t rows = 0;
+        for (const Dataset& chunk : chunks) rows += chunk.size();
+        data.reserve(rows);
+        for (const Dataset& chunk : chunks) data.append(chunk);
+        return data;
+    }
+
+    //Position just past the first newline at or after from that is outside quotes, given the quote state at from
+    static size_t nextRecord(std::string_view text, size_t from, bool inQuotes) {
+        for (size_t i = from; i < text.size(); ++i) {
+            char c = text[i];
+            if (c == '"') inQuotes = !inQuotes;
+            else if (c == '\n' && !inQuotes) return i + 1;
+        }
+        return text.size();
+    }
+
+public:
+    //Whole Passenger records, names, tickets and cabins included, from a csv stream positioned at
+    //its header. Reads line by line, so quoted fields must not contain newlines; lines with fewer
+    //than 12 fields are skipped.
+    static std::vector<Passenger> loadPassengers(std::istream& file) {
+        std::string line;
+        std::vector<Passenger> data;
+
+        std::vector<std::string> fields;
+
+        std::getline(file, line); // skip header
+        while (std::getline(file, line)) {
+            bool inQuotes = false;
+            std::string temp = "";
+            for (char c : line) {
+                if (c == '"')
+                    inQuotes = !inQuotes;
+                else if (c == ',' && !inQuotes) {
+                    fields.push_back(temp);
+                    temp.clear();
+                }
+                else
+                    temp += c;
+            }
+            fields.push_back(temp);
+            if (fields.size() >= FieldCount)
+                data.emplace_back(fields);
+            fields.clear();
+        }
+        return data;
+    }
+
+    //Append the records in text (whole records, no header) to chunk
+    static void parseRecords(std::string_view text, Dataset& chunk) {
+        std::string_view fields[FieldCount];
+        std::string unquoted[FieldCount]; //reused buffers for fields that contained quotes
+        int values[NumFeatures];
+        size_t position = 0;
+        while (position < text.size()) {
+            int fieldCount = 0;
+            position = scanRecord(text, position, [&](int column, size_t begin, size_t end, bool quoted) {
+                fieldCount = column + 1;
+                if (column < FieldCount) fields[column] = unquote(text.substr(begin, end - begin), quoted, unquoted[column]);
+            });
+            if (fieldCount < FieldCount) continue;
+
+            bool survived = requiredInt(fields[1], "Survived") == 1;
+            values[PClass] = requiredInt(fields[2], "Pclass");
+            values[Sex] = chunk.encodeCategory(Sex, fields[4]);
+            values[Age] = optionalInt(fields[5]);
+            values[SibSp] = requiredInt(fields[6], "SibSp");
+            values[Parch] = requiredInt(fields[7], "Parch");
+            values[Fare] = optionalInt(fields[9]);
+            values[Embarked] = chunk.encodeCategory(Embarked, fields[11].empty() ? std::string_view("U") : fields[11].substr(0, 1));
+            chunk.appendRow(survived, values);
+        }
+    }
+
+    //Append the records in text (whole records, no header) to chunk, whose schema gives the features:
+    //feature f is csv column featureColumns[f] and the 0/1 label is column labelColumn. Numeric fields
+    //are read as by parseFixed with the feature's decimals, MissingValue if empty. Records with too few
+    //fields are skipped. Throws std::runtime_error if a label or numeric field is invalid.
+    static void parseTableRecords(std::string_view text, const std::vector<int>& featureColumns, int labelColumn, Dataset& chunk) {
+        const FeatureSchema& schema = *chunk.schema();
+        int fieldCount = labelColumn + 1;
+        for (int column : featureColumns) fieldCount = std::max(fieldCount, column + 1);
+        std::vector<std::string_view> fields(fieldCount);
+        std::vector<std::string> unquoted(fieldCount);
+        std::vector<int> values(schema.featureCount());
+        size_t position = 0;
+        while (position < text.size()) {
+            int recordFields = 0;
+            position = scanRecord(text, position, [&](int column, size_t begin, size_t end, bool quoted) {
+                recordFields = column + 1;
+                if (column < fieldCount) fields[column] = unquote(text.substr(begin, end - begin), quoted, unquoted[column]);
+            });
+            if (recordFields < fieldCount) continue;
+
+            bool label = requiredInt(fields[labelColumn], "label") == 1;
+            for (int featureIdx = 0; featureIdx < schema.featureCount(); ++featureIdx) {
+                std::string_view field = fields[featureColumns[featureIdx]];
+                if (schema.isCategorical(featureIdx)) values[featureIdx] = chunk.encodeCategory(featureIdx, field);
+                else if (field.empty()) values[featureIdx] = MissingValue;
+                else if (!parseFixed(field, schema.feature(featureIdx).decimals, values[featureIdx]))
+                    throw std::runtime_error("invalid " + schema.name(featureIdx) + " value: " + std::string(field));
+            }
+            chunk.appendRow(label, values.data());
+        }
+    }
+
+    //Append one row given by its features alone, "Pclass,Sex,Age,SibSp,Parch,Fare,Embarked" with
+    //values as in the csv (Age, Fare and Embarked may be empty), labelled not survived. Unlike in
+    //training data, a non-empty Age or Fare must be a number too, so a mistyped request is refused
+    //instead of scored as missing. Throws std::runtime_error if the field count is wrong or a
+    //numeric field is invalid.
+    static void parseFeatures(std::string_view record, Dataset& rows) {
+        if (!record.empty() && record.back() == '\r') record.remove_suffix(1);
+        std::string_view fields[NumFeatures];
+        int fieldCount = 0;
+        size_t fieldStart = 0;
+        for (size_t position = 0; position <= record.size(); ++position) {
+            if (position < record.size() && record[position] != ',') continue;
+            if (fieldCount == NumFeatures) throw std::runtime_error("expected 7 fields: " + std::string(record));
+            fields[fieldCount++] = record.substr(fieldStart, position - fieldStart);
+            fieldStart = position + 1;
+        }
+        if (fieldCount < NumFeatures) throw std::runtime_error("expected 7 fields: " + std::string(record));
+
+        int values[NumFeatures];
+        values[PClass] = requiredInt(fields[PClass], "Pclass");
+        values[SibSp] = requiredInt(fields[SibSp], "SibSp");
+        values[Parch] = requiredInt(fields[Parch], "Parch");
+        values[Age] = fields[Age].empty() ? -1 : requiredInt(fields[Age], "Age");
+        values[Fare] = fields[Fare].empty() ? -1 : requiredInt(fields[Fare], "Fare");
+        values[Sex] = rows.encodeCategory(Sex, fields[Sex]);
+        values[Embarked] = rows.encodeCategory(Embarked, fields[Embarked].empty() ? std::string_view("U") : fields[Embarked].substr(0, 1));
+        rows.appendRow(false, values);
+    }
+
+    //nThreads <= 0 uses every hardware thread. Throws std::runtime_error if the file cannot be
+    //read or a required numeric field is invalid.
+    static Dataset load(const std::string& filename, int nThreads = 0) {
+        MappedFile file(filename);
+        std::string_view text(file.data(), file.size());
+        size_t dataStart = text.find('\n'); //skip header
+        if (dataStart == std::string_view::npos) return Dataset();
+        ++dataStart;
+
+        return parseChunks(text, dataStart, FeatureSchema::titanic(), nThreads, parseRecords);
+    }
+
+    //Load a csv with a header row into a Dataset of the given schema: every feature is read from
+    //the column of the same name and the 0/1 label from labelColumn, as by parseTableRecords.
+    //nThreads <= 0 uses every hardware thread. Throws std::runtime_error if the file cannot be
+    //read, a column is not in the header or a label or numeric field is invalid.
+    static Dataset loadTable(const std::string& filename, std::shared_ptr<const FeatureSchema> schema, const std::string& labelColumn,
+        int nThreads = 0) {
+        MappedFile file(filename);
+        std::string_view text(file.data(), file.size());
+        std::vector<std::string> header;
+        std::string buffer;
+        size_t dataStart = scanRecord(text, 0, [&](int, size_t begin, size_t end, bool quoted) {
+            header.emplace_back(unquote(text.substr(begin, end - begin), quoted, buffer));
+        });
+        auto columnOf = [&](const std::string& name) {
+            auto it = std::find(header.begin(), header.end(), name);
+            if (it == header.end()) throw std::runtime_error("no column " + name + " in " + filename);
+            return (int)(it - header.begin());
+        };
+        int label = columnOf(labelColumn);
+        std::vector<int> featureColumns(schema->featureCount());
+        for (int featureIdx = 0; featureIdx < schema->featureCount(); ++featureIdx) featureColumns[featureIdx] = columnOf(schema->name(featureIdx));
+        if (dataStart >= text.size()) return Dataset(schema);
+        return parseChunks(text, dataStart, schema, nThreads, [&](std::string_view records, Dataset& chunk) {
+            parseTableRecords(records, featureColumns, label, chunk);
+        });
+    }
+};
+
+
+//Reads the passengers csv front to back in chunks of about chunkBytes, for files too large to
+//load at once. Every chunk shares the same category dictionaries, so codes are the same in all
+//chunks and in every pass over the file.
+class CsvChunkReader {
+private:
+    std::ifstream file;
+    std::streampos dataStart; //first record, after the header
+    size_t chunkBytes;
+    std::string buffer; //bytes read from the file and not parsed yet, starting at a record boundary
+    bool endOfFile = false;
+    Dataset schema; //owner of the shared dictionaries
+
+    //End of the last complete record in text, 0 if there is none
+    static size_t lastRecordEnd(std::string_view text) {
+        bool inQuotes = false;
+        size_t end = 0;
+        for (size_t i = 0; i < text.size(); ++i) {
+            if (text[i] == '"') inQuotes = !inQuotes;
+            else if (text[i] == '\n' && !inQuotes) end = i + 1;
+        }
+        return end;
+    }
+
+public:
+    //Throws std::runtime_error if the file cannot be opened
+    explicit CsvChunkReader(const std::string& filename, size_t chunkBytes = 16 << 20) :
+        file(filename, std::ios::binary), chunkBytes(std::max<size_t>(chunkBytes, 1)) {
+        if (!file.is_open()) throw std::runtime_error("cannot open " + filename);
+        std::string header;
+        std::getline(file, header);
+        dataStart = file.tellg();
+        endOfFile = !file;
+    }
+
+    //Start over at the first record
+    void rewind() {
+        file.clear();
+        file.seekg(dataStart);
+        buffer.clear();
+        endOfFile = !file;
+    }
+
+    //Replace chunk with the next records; false at the end of the file
+    bool next(Dataset& chunk) {
+        chunk = schema.emptyLike();
+        while (chunk.size() == 0) {
+            size_t complete = 0;
+            while (!endOfFile && complete == 0) {
+                size_t kept = buffer.size();
+                buffer.resize(kept + chunkBytes);
+                file.read(&buffer[kept], chunkBytes);
+                buffer.resize(kept + (size_t)file.gcount());
+                endOfFile = !file;
+                complete = lastRecordEnd(buffer);
+            }
+            if (endOfFile) complete = buffer.size();
+            if (complete == 0) return false;
+            CsvLoader::parseRecords(std::string_view(buffer).substr(0, complete), chunk);
+            buffer.erase(0, complete);
+        }
+        return true;
+    }
+
+    //Dataset without rows that shares the chunks' category dictionaries
+    Dataset emptyLike() const {
+        return schema.emptyLike();
+    }
+};
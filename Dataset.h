@@ -0,0 +1,429 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <deque>
+#include <string_view>
+
+//Passenger data structure
+struct Passenger {
+    int passengerID;
+    bool survived;
+    int pclass; //ticket class
+    std::string name;
+    std::string sex;
+    int age;
+    int sibSp; //sibling or spouse aboard
+    int parch; //number of parent/children aboard
+    std::string ticket;
+    int fare;
+    std::string cabin;
+    std::string embarked; //port(C, Q, S)
+
+    Passenger(const std::vector<std::string>& fields) {
+        passengerID = std::stoi(fields[0]);
+        survived = std::stoi(fields[1]) == 1;
+        pclass = std::stoi(fields[2]);
+        name = fields[3];
+        sex = fields[4];
+        try {
+            age = fields[5].empty() ? -1 : std::stoi(fields[5]);
+        }
+        catch (...) {
+            age = -1;
+        }
+        sibSp = std::stoi(fields[6]);
+        parch = std::stoi(fields[7]);
+        ticket = fields[8];
+        try {
+            fare = fields[9].empty() ? -1 : std::stoi(fields[9]);
+        }
+        catch (...) {
+            fare = -1;
+        }
+        cabin = fields[10];
+        embarked = fields[11].empty() ? "U" : fields[11].substr(0, 1);
+    }
+    friend std::ostream& operator<<(std::ostream& stream, const Passenger& p) {
+        stream << p.passengerID << "," << p.survived << "," << p.pclass << "," << p.name << "," << p.sex << "," << p.age << "," << p.sibSp << "," << p.parch << "," << p.ticket << "," << p.fare << "," << p.cabin << "," << p.embarked << "\n";
+        return stream;
+    }
+};
+
+
+//Features of the Titanic schema (see FeatureSchema::titanic), which the Passenger API and the
+//mapped, compact and compiled forests use; the value is the featureIdx stored in tree nodes
+enum Feature { PClass = 0, Sex = 1, Age = 2, SibSp = 3, Parch = 4, Fare = 5, Embarked = 6 };
+constexpr int NumFeatures = 7;
+
+inline bool isCategoricalFeature(int featureIdx) {
+    return featureIdx == Sex || featureIdx == Embarked;
+}
+
+inline bool isNumericFeature(int featureIdx) {
+    return !isCategoricalFeature(featureIdx);
+}
+
+//Name of a feature as in the Passenger fields
+inline const char* featureName(int featureIdx) {
+    static const char* names[NumFeatures] = { "pclass", "sex", "age", "sibSp", "parch", "fare", "embarked" };
+    return names[featureIdx];
+}
+
+//Age and fare are stored as -1 when the csv has no value; missing values never go left
+inline bool isMissingValue(int featureIdx, int value) {
+    return (featureIdx == Age || featureIdx == Fare) && value < 0;
+}
+
+
+//How a feature column is split: numeric values by a threshold, categorical codes by equality
+enum class FeatureKind : uint8_t { Numeric, Categorical };
+
+//Stored value of a numeric field without a value (see FeatureSpec::missingBelow)
+constexpr int MissingValue = std::numeric_limits<int>::min();
+
+struct FeatureSpec {
+    std::string name;
+    FeatureKind kind = FeatureKind::Numeric;
+    int missingBelow = MissingValue + 1; //numeric: stored values below it have no value and never go left
+    int decimals = 0; //numeric: fraction digits kept, values are stored times 10^decimals ("7.25" with 2 is 725)
+};
+
+//Columns of a Dataset, in featureIdx order, and how trees split on them. Shared by every
+//dataset and tree built from the same source; the Titanic one is the default.
+class FeatureSchema {
+private:
+    std::vector<FeatureSpec> features;
+
+public:
+    static constexpr int MaxDecimals = 9; //10^9 still fits an int
+
+    //Throws std::invalid_argument if there are more features than a tree node can index or a
+    //feature's decimals are not in [0, MaxDecimals]
+    explicit FeatureSchema(std::vector<FeatureSpec> features) : features(std::move(features)) {
+        if (this->features.size() > (size_t)std::numeric_limits<int16_t>::max()) throw std::invalid_argument("too many features");
+        for (const FeatureSpec& spec : this->features) {
+            if (spec.decimals < 0 || spec.decimals > MaxDecimals) throw std::invalid_argument("invalid decimals of feature " + spec.name);
+        }
+    }
+
+    //First int of a model file of trees trained on a schema other than the Titanic one, which
+    //follows it; Titanic model files keep the layout they always had
+    static constexpr int ModelSchemaMarker = std::numeric_limits<int>::min();
+
+    //Passenger features as in the Feature enum; age and fare are missing when negative
+    static const std::shared_ptr<const FeatureSchema>& titanic() {
+        static const std::shared_ptr<const FeatureSchema> schema = std::make_shared<const FeatureSchema>(std::vector<FeatureSpec>{
+            { "pclass", FeatureKind::Numeric, MissingValue }, { "sex", FeatureKind::Categorical, MissingValue },
+            { "age", FeatureKind::Numeric, 0 }, { "sibSp", FeatureKind::Numeric, MissingValue }, { "parch", FeatureKind::Numeric, MissingValue },
+            { "fare", FeatureKind::Numeric, 0 }, { "embarked", FeatureKind::Categorical, MissingValue } });
+        return schema;
+    }
+
+    int featureCount() const {
+        return (int)features.size();
+    }
+
+    const FeatureSpec& feature(int featureIdx) const {
+        return features[featureIdx];
+    }
+
+    const std::string& name(int featureIdx) const {
+        return features[featureIdx].name;
+    }
+
+    FeatureKind kind(int featureIdx) const {
+        return features[featureIdx].kind;
+    }
+
+    bool isCategorical(int featureIdx) const {
+        return features[featureIdx].kind == FeatureKind::Categorical;
+    }
+
+    bool isMissing(int featureIdx, int value) const {
+        return features[featureIdx].kind == FeatureKind::Numeric && value < features[featureIdx].missingBelow;
+    }
+
+    //Index of the feature with the given name, -1 if there is none
+    int find(std::string_view name) const {
+        for (size_t featureIdx = 0; featureIdx < features.size(); ++featureIdx) {
+            if (features[featureIdx].name == name) return (int)featureIdx;
+        }
+        return -1;
+    }
+
+    //Same features in the same order, so codes, values and trees are interchangeable
+    bool operator==(const FeatureSchema& other) const {
+        if (features.size() != other.features.size()) return false;
+        for (size_t featureIdx = 0; featureIdx < features.size(); ++featureIdx) {
+            const FeatureSpec& a = features[featureIdx];
+            const FeatureSpec& b = other.features[featureIdx];
+            if (a.name != b.name || a.kind != b.kind || a.missingBelow != b.missingBelow || a.decimals != b.decimals) return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const FeatureSchema& other) const {
+        return !(*this == other);
+    }
+
+    bool isTitanic() const {
+        return *this == *titanic();
+    }
+
+    //Start of a model file: nothing for the Titanic schema, else ModelSchemaMarker, the feature
+    //count and per feature its name, kind, missingBelow and decimals
+    void writeModelHeader(std::ostream& out) const {
+        if (isTitanic()) return;
+        int marker = ModelSchemaMarker, count = featureCount();
+        out.write(reinterpret_cast<const char*>(&marker), sizeof(marker));
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        for (const FeatureSpec& spec : features) {
+            size_t length = spec.name.size();
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(spec.name.data(), length);
+            out.write(reinterpret_cast<const char*>(&spec.kind), sizeof(spec.kind));
+            out.write(reinterpret_cast<const char*>(&spec.missingBelow), sizeof(spec.missingBelow));
+            out.write(reinterpret_cast<const char*>(&spec.decimals), sizeof(spec.decimals));
+        }
+    }
+
+    //Schema of a model file as written by writeModelHeader, the Titanic one if the file does not
+    //start with ModelSchemaMarker (in is then left where it was). If expected is given the file's
+    //schema must equal it, and expected is returned so trees and datasets keep sharing it.
+    //Throws std::runtime_error if the schema is truncated or invalid or differs from expected.
+    static std::shared_ptr<const FeatureSchema> readModelHeader(std::istream& in, std::shared_ptr<const FeatureSchema> expected) {
+        std::istream::pos_type start = in.tellg();
+        int marker = 0;
+        in.read(reinterpret_cast<char*>(&marker), sizeof(marker));
+        std::shared_ptr<const FeatureSchema> schema = titanic();
+        if (in && marker == ModelSchemaMarker) {
+            int count = -1;
+            in.read(reinterpret_cast<char*>(&count), sizeof(count));
+            if (!in || count < 0 || count > std::numeric_limits<int16_t>::max()) throw std::runtime_error("invalid feature schema in model file");
+            std::vector<FeatureSpec> specs(count);
+            for (FeatureSpec& spec : specs) {
+                size_t length = 0;
+                in.read(reinterpret_cast<char*>(&length), sizeof(length));
+                if (!in || length > 1 << 16) throw std::runtime_error("invalid feature schema in model file");
+                spec.name.resize(length);
+                in.read(spec.name.data(), length);
+                in.read(reinterpret_cast<char*>(&spec.kind), sizeof(spec.kind));
+                in.read(reinterpret_cast<char*>(&spec.missingBelow), sizeof(spec.missingBelow));
+                in.read(reinterpret_cast<char*>(&spec.decimals), sizeof(spec.decimals));
+                if (!in || spec.kind > FeatureKind::Categorical || spec.decimals < 0 || spec.decimals > MaxDecimals)
+                    throw std::runtime_error("invalid feature schema in model file");
+            }
+            schema = std::make_shared<const FeatureSchema>(std::move(specs));
+        }
+        else {
+            in.clear();
+            in.seekg(start);
+        }
+        if (!expected) return schema;
+        if (*expected != *schema) throw std::runtime_error("model file was trained on another feature schema");
+        return expected;
+    }
+};
+
+
+//Category strings of one column mapped to dense codes in order of first appearance
+class CategoryDictionary {
+private:
+    std::deque<std::string> levels; //stable addresses, the keys of codes point into them
+    std::unordered_map<std::string_view, int> codes;
+
+    void reindex() {
+        codes.clear();
+        for (size_t code = 0; code < levels.size(); ++code) codes.emplace(levels[code], (int)code);
+    }
+
+public:
+    CategoryDictionary() = default;
+    CategoryDictionary(const CategoryDictionary& other) : levels(other.levels) {
+        reindex();
+    }
+    CategoryDictionary& operator=(const CategoryDictionary& other) {
+        if (this != &other) {
+            levels = other.levels;
+            reindex();
+        }
+        return *this;
+    }
+    CategoryDictionary(CategoryDictionary&&) = default;
+    CategoryDictionary& operator=(CategoryDictionary&&) = default;
+
+    //Code of the category, adding it if it is new
+    int encode(std::string_view category) {
+        auto it = codes.find(category);
+        if (it != codes.end()) return it->second;
+        int code = (int)levels.size();
+        levels.emplace_back(category);
+        codes.emplace(levels.back(), code);
+        return code;
+    }
+
+    //Code of the category, or -1 if it was never seen
+    int find(std::string_view category) const {
+        auto it = codes.find(category);
+        return it == codes.end() ? -1 : it->second;
+    }
+
+    const std::string& decode(int code) const {
+        return levels[code];
+    }
+
+    int size() const {
+        return (int)levels.size();
+    }
+};
+
+
+//Column-oriented training data.
+//Every feature of the schema is one contiguous int array indexed by row; categorical features
+//hold codes into a dictionary that is shared by all datasets derived from the same source, so
+//codes stay comparable across subsets and bootstrap samples.
+class Dataset {
+private:
+    std::shared_ptr<const FeatureSchema> featureSchema;
+    std::vector<uint8_t> labels; //survived (the label column), 0 or 1
+    std::vector<std::vector<int>> columns;
+    std::vector<std::shared_ptr<CategoryDictionary>> dictionaries;
+
+public:
+    //Empty dataset of the Titanic schema
+    Dataset() : Dataset(FeatureSchema::titanic()) {}
+
+    explicit Dataset(std::shared_ptr<const FeatureSchema> schema) :
+        featureSchema(std::move(schema)), columns(featureSchema->featureCount()), dictionaries(featureSchema->featureCount()) {
+        for (int featureIdx = 0; featureIdx < featureSchema->featureCount(); ++featureIdx) {
+            if (featureSchema->isCategorical(featureIdx)) dictionaries[featureIdx] = std::make_shared<CategoryDictionary>();
+        }
+    }
+
+    explicit Dataset(const std::vector<Passenger>& passengers) : Dataset() {
+        reserve(passengers.size());
+        for (const Passenger& p : passengers) append(p);
+    }
+
+    //Empty dataset sharing this one's schema and category dictionaries
+    Dataset emptyLike() const {
+        Dataset result(featureSchema);
+        result.dictionaries = dictionaries;
+        return result;
+    }
+
+    const std::shared_ptr<const FeatureSchema>& schema() const {
+        return featureSchema;
+    }
+
+    int featureCount() const {
+        return (int)columns.size();
+    }
+
+    //Rows at the given indices, in that order (indices may repeat)
+    Dataset subset(const std::vector<int>& rows) const {
+        Dataset result = emptyLike();
+        result.labels.resize(rows.size());
+        for (size_t i = 0; i < rows.size(); ++i) result.labels[i] = labels[rows[i]];
+        for (int featureIdx = 0; featureIdx < featureCount(); ++featureIdx) {
+            const std::vector<int>& from = columns[featureIdx];
+            std::vector<int>& to = result.columns[featureIdx];
+            to.resize(rows.size());
+            for (size_t i = 0; i < rows.size(); ++i) to[i] = from[rows[i]];
+        }
+        return result;
+    }
+
+    void reserve(size_t rows) {
+        labels.reserve(rows);
+        for (std::vector<int>& column : columns) column.reserve(rows);
+    }
+
+    //Code of a category of a categorical feature, adding it to the shared dictionary if it is new
+    int encodeCategory(int featureIdx, std::string_view category) {
+        return dictionaries[featureIdx]->encode(category);
+    }
+
+    //Append one row; values[f] is the value of feature f, a code from encodeCategory for categorical features
+    void appendRow(bool survived, const int* values) {
+        labels.push_back(survived ? 1 : 0);
+        for (int featureIdx = 0; featureIdx < featureCount(); ++featureIdx) columns[featureIdx].push_back(values[featureIdx]);
+    }
+
+    //The dataset must have the Titanic schema
+    void append(const Passenger& p) {
+        int values[NumFeatures];
+        values[PClass] = p.pclass;
+        values[Sex] = encodeCategory(Sex, p.sex);
+        values[Age] = p.age;
+        values[SibSp] = p.sibSp;
+        values[Parch] = p.parch;
+        values[Fare] = p.fare;
+        values[Embarked] = encodeCategory(Embarked, p.embarked);
+        appendRow(p.survived, values);
+    }
+
+    //Append all rows of another dataset of the same schema, translating its category codes into
+    //this dataset's dictionaries
+    void append(const Dataset& other) {
+        labels.insert(labels.end(), other.labels.begin(), other.labels.end());
+        for (int featureIdx = 0; featureIdx < featureCount(); ++featureIdx) {
+            const std::vector<int>& from = other.columns[featureIdx];
+            std::vector<int>& to = columns[featureIdx];
+            if (!featureSchema->isCategorical(featureIdx) || dictionaries[featureIdx] == other.dictionaries[featureIdx]) {
+                to.insert(to.end(), from.begin(), from.end());
+                continue;
+            }
+            const CategoryDictionary& otherDictionary = *other.dictionaries[featureIdx];
+            std::vector<int> codes(otherDictionary.size());
+            for (int code = 0; code < otherDictionary.size(); ++code) codes[code] = dictionaries[featureIdx]->encode(otherDictionary.decode(code));
+            for (int code : from) to.push_back(codes[code]);
+        }
+    }
+
+    size_t size() const {
+        return labels.size();
+    }
+
+    const std::vector<uint8_t>& label() const {
+        return labels;
+    }
+
+    const std::vector<int>& column(int featureIdx) const {
+        return columns[featureIdx];
+    }
+
+    //Values of rows [begin, begin + count) as tree nodes compare them: feature f goes to
+    //values[f * stride + r], categorical features as this dataset's codes and missing values as NaN
+    void encodeBlock(size_t begin, int count, int stride, double* values) const {
+        const double missing = std::numeric_limits<double>::quiet_NaN();
+        for (int featureIdx = 0; featureIdx < featureCount(); ++featureIdx) {
+            const int* column = columns[featureIdx].data() + begin;
+            double* out = values + (size_t)featureIdx * stride;
+            if (featureSchema->isCategorical(featureIdx)) {
+                for (int r = 0; r < count; ++r) out[r] = column[r];
+                continue;
+            }
+            int missingBelow = featureSchema->feature(featureIdx).missingBelow;
+            for (int r = 0; r < count; ++r)
+                out[r] = column[r] < missingBelow ? missing : column[r];
+        }
+    }
+
+    //Dictionary of a categorical feature
+    const CategoryDictionary& dictionary(int featureIdx) const {
+        return *dictionaries[featureIdx];
+    }
+
+    //The same dictionary, for trees that keep using this dataset's codes after training
+    std::shared_ptr<const CategoryDictionary> sharedDictionary(int featureIdx) const {
+        return dictionaries[featureIdx];
+    }
+};
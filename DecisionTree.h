@@ -9,472 +9,1406 @@
 #include <unordered_map>
 #include <numeric>
 #include <fstream>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
 
-//Passenger data structure
-struct Passenger {
-    int passengerID;
-    bool survived;
-    int pclass; //ticket class
-    std::string name;
-    std::string sex;
-    int age;
-    int sibSp; //sibling or spouse aboard
-    int parch; //number of parent/children aboard
-    std::string ticket;
-    int fare;
-    std::string cabin;
-    std::string embarked; //port(C, Q, S)
-
-    Passenger(const std::vector<std::string>& fields) {
-        passengerID = std::stoi(fields[0]);
-        survived = std::stoi(fields[1]) == 1;
-        pclass = std::stoi(fields[2]);
-        name = fields[3];
-        sex = fields[4];
-        try {
-            age = fields[5].empty() ? -1 : std::stoi(fields[5]);
-        }
-        catch (...) {
-            age = -1;
-        }
-        sibSp = std::stoi(fields[6]);
-        parch = std::stoi(fields[7]);
-        ticket = fields[8];
-        try {
-            fare = fields[9].empty() ? -1 : std::stoi(fields[9]);
-        }
-        catch (...) {
-            fare = -1;
-        }
-        cabin = fields[10];
-        embarked = fields[11].empty() ? "U" : fields[11].substr(0, 1);
-    }
-    friend std::ostream& operator<<(std::ostream& stream, const Passenger& p) {
-        stream << p.passengerID << "," << p.survived << "," << p.pclass << "," << p.name << "," << p.sex << "," << p.age << "," << p.sibSp << "," << p.parch << "," << p.ticket << "," << p.fare << "," << p.cabin << "," << p.embarked << "\n";
-        return stream;
+#include "Dataset.h"
+#include "Telemetry.h"
+#include "ThreadPool.h"
+
+//Node of a DecisionTree, stored in one contiguous array per tree.
+//Children are indices into that array; nodes are laid out in preorder.
+struct TreeNode {
+    double splitValue = 0; //split threshold for numerical features
+    int32_t left = -1; //child indices (-1 for leaf)
+    int32_t right = -1;
+    int16_t featureIdx = -1; //Feature index used for splitting (-1 for leaf)
+    bool isLeaf = false;
+    bool leafClass = false; //class prediction if leaf
+    int32_t categorySet = -1; //categorical splits: start of the set of codes going left in the tree's category sets (-1 for numerical)
+};
+
+
+//Category sets of a tree are stored one after another in a single array of words: each is its
+//word count followed by its bits, code c being bit c % 64 of word c / 64.
+
+//Bits of a set of category codes, without trailing zero words
+inline std::vector<uint64_t> categoryBits(const int* codes, size_t count) {
+    std::vector<uint64_t> bits;
+    for (size_t i = 0; i < count; ++i) {
+        if (codes[i] / 64 >= (int)bits.size()) bits.resize(codes[i] / 64 + 1, 0);
+        bits[codes[i] / 64] |= 1ull << (codes[i] % 64);
+    }
+    return bits;
+}
+
+//Append a set to category sets and return where it starts
+inline int32_t appendCategorySet(std::vector<uint64_t>& sets, const std::vector<uint64_t>& bits) {
+    int32_t at = (int32_t)sets.size();
+    sets.push_back(bits.size());
+    sets.insert(sets.end(), bits.begin(), bits.end());
+    return at;
+}
+
+//Whether a code is in the set starting at sets[at]; unseen categories (-1) are in no set
+inline bool inCategorySet(const uint64_t* sets, int32_t at, int code) {
+    return code >= 0 && (uint64_t)code < 64 * sets[at] && ((sets[at + 1 + code / 64] >> (code % 64)) & 1) != 0;
+}
+
+
+//Well-mixed 64-bit hash (splitmix64 finalizer), for deriving independent random streams from keys
+inline uint64_t hashMix(uint64_t z) {
+    z += 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+
+//Split test of one feature kind. Kernels that loop over rows take the kind as a template
+//argument, so it is resolved once per feature rather than for every row.
+template <FeatureKind Kind>
+struct SplitTest {
+    //missingBelow as in FeatureSpec: numeric values without a value never go left.
+    //Categorical values go left if they are in the set of categoryWords words of bits.
+    static bool goesLeft(int value, double splitValue, const uint64_t* categoryBits, size_t categoryWords, int missingBelow) {
+        if constexpr (Kind == FeatureKind::Categorical)
+            return value >= 0 && (size_t)value < 64 * categoryWords && ((categoryBits[value / 64] >> (value % 64)) & 1) != 0;
+        else return value <= splitValue && value >= missingBelow;
     }
 };
 
 
-struct TreeNode {
-    int featureIdx; //Feature index used for splitting (-1 for leaf)
-    double splitValue; //split threshold for numerical features
-    std::string splitCategory; //for categorical splits
-    bool isLeaf;
-    bool leafClass; //class prediction if leaf
-    TreeNode* left;
-    TreeNode* right;
-    TreeNode() : featureIdx(-1), splitValue(0), isLeaf(false), leafClass(false), left(nullptr), right(nullptr) {}
-    ~TreeNode() {}
+//Bins of a level-wise (streaming) training run, shared by all trees: numerical features are
+//quantized by their edges, categorical features get one bin per code. A node histogram holds
+//the class counts of every bin of every feature, followed by the node's total class counts.
+struct HistogramLayout {
+    std::shared_ptr<const FeatureSchema> schema;
+    std::vector<std::vector<double>> edges; //numerical features: largest value in each bin
+    std::vector<size_t> offset; //start of each feature's {count0, count1} pairs, then of the total counts
+
+    HistogramLayout() = default;
+    explicit HistogramLayout(std::shared_ptr<const FeatureSchema> featureSchema) :
+        schema(std::move(featureSchema)), edges(schema->featureCount()), offset(schema->featureCount() + 1, 0) {}
+
+    //Edges of at most nBins equal-frequency bins over sorted (value, row count) pairs;
+    //one bin per value if there are no more than nBins of them (as in histogram mode)
+    static std::vector<double> quantileEdges(const std::vector<std::pair<int, uint64_t>>& valueCounts, int nBins) {
+        std::vector<double> result;
+        if ((int)valueCounts.size() <= nBins) {
+            for (const auto& entry : valueCounts) result.push_back(entry.first);
+            return result;
+        }
+        uint64_t total = 0;
+        for (const auto& entry : valueCounts) total += entry.second;
+        uint64_t cumulative = 0;
+        size_t at = 0;
+        for (int b = 1; b <= nBins; ++b) {
+            uint64_t rank = std::max<uint64_t>((total * b + nBins - 1) / nBins, 1);
+            while (cumulative + valueCounts[at].second < rank) cumulative += valueCounts[at++].second;
+            double edge = valueCounts[at].first;
+            if (result.empty() || edge > result.back()) result.push_back(edge);
+        }
+        return result;
+    }
+
+    //Set the bins of each feature in turn, in feature order
+    void setBins(int featureIdx, std::vector<double> featureEdges, int nCategories) {
+        edges[featureIdx] = std::move(featureEdges);
+        size_t nBins = schema->isCategorical(featureIdx) ? nCategories : edges[featureIdx].size();
+        offset[featureIdx + 1] = offset[featureIdx] + 2 * nBins;
+    }
+
+    //Counters per node histogram
+    size_t size() const {
+        return offset.back() + 2;
+    }
+
+    //Add the weights of rows [0, count) to the class counts of their bins of one feature, row r
+    //in histogram slots[r] of histograms (none if -1). Missing values have no bin (they always go right).
+    template <FeatureKind Kind>
+    void addCounts(int featureIdx, const int* column, const uint8_t* labels, const int* slots, const int* weights,
+        size_t count, unsigned* histograms) const {
+        size_t stride = size(), at = offset[featureIdx];
+        const std::vector<double>& e = edges[featureIdx];
+        int missingBelow = schema->feature(featureIdx).missingBelow;
+        for (size_t r = 0; r < count; ++r) {
+            if (slots[r] < 0) continue;
+            int value = column[r];
+            size_t bin = value;
+            if constexpr (Kind == FeatureKind::Numeric) {
+                if (value < missingBelow) continue;
+                bin = std::min<size_t>(std::lower_bound(e.begin(), e.end(), (double)value) - e.begin(), e.size() - 1);
+            }
+            histograms[slots[r] * stride + at + 2 * bin + labels[r]] += weights[r];
+        }
+    }
+
+    //addCounts for a feature of either kind
+    void addFeatureCounts(int featureIdx, const int* column, const uint8_t* labels, const int* slots, const int* weights,
+        size_t count, unsigned* histograms) const {
+        if (schema->isCategorical(featureIdx)) addCounts<FeatureKind::Categorical>(featureIdx, column, labels, slots, weights, count, histograms);
+        else addCounts<FeatureKind::Numeric>(featureIdx, column, labels, slots, weights, count, histograms);
+    }
 };
 
 
 class DecisionTree {
 private:
     int maxDepth;
-    int minSamplesSplit;
-    int minSamplesLeaf;
+    unsigned minSamplesSplit; //compared with sample counts; negative settings become 0, no limit
+    unsigned minSamplesLeaf;
     double featureSampleRatio;
+    int maxBins; //histogram mode when > 0: numerical features are quantized into at most maxBins (<= 255) bins
+    int nThreads; //threads used by train (1: serial)
+    bool extraTrees; //extremely randomized trees: one random split per sampled feature, see findBestSplit
     std::unordered_map<int, double> featureImportance;
-    TreeNode* root;
+    std::vector<TreeNode> nodes; //root first
+    std::vector<uint64_t> categorySets; //sets of the categorical splits, see TreeNode::categorySet
+    std::shared_ptr<const FeatureSchema> featureSchema = FeatureSchema::titanic(); //of the training data
+    bool titanicSchema = true; //Passenger rows can be predicted
+    int levelCount; //node levels on the longest root-to-leaf path, updated whenever nodes change
+    std::vector<std::shared_ptr<const CategoryDictionary>> categories; //category codes used by the nodes, per feature, shared with the dataset they come from
+    std::mt19937 rng; //feature sampling stream of level-wise training
+    std::vector<char> goesLeft; //per-row side flags used while partitioning presorted lists
+    std::vector<unsigned> weights; //per-row multiplicity in the training sample (bootstrap count), 0 if left out
 
+    //parallel training: nodes with at least ParallelSplitRows rows search their features concurrently,
+    //and both children of a node get their own task when each has at least ParallelSubtreeRows rows
+    static constexpr size_t ParallelSplitRows = 8192;
+    static constexpr size_t ParallelSubtreeRows = 1024;
+    ThreadPool* pool = nullptr; //set during train when nThreads != 1
+    TrainingTelemetry* telemetry = nullptr; //optional, see setTelemetry
 
-    //Calculate Gini impurity
-    double calculateGini(const std::vector<bool>& labels) {
-        if (labels.empty()) return 0.0;
-        unsigned count0 = 0, count1 = 0;
-        for (bool label : labels) {
-            if (label) ++count1;
-            else ++count0;
-        }
-        double p0 = (double)(count0) / labels.size();
-        double p1 = (double)(count1) / labels.size();
-        return 1.0 - (p0 * p0 + p1 * p1);
-    }
+    struct SplitCandidate {
+        double gini = 1.0;
+        double value = 0.0;
+        int prefix = 0; //categorical: number of categories in rate order going left
+        std::vector<uint64_t> categories; //categorical: bits of the categories going left
+    };
 
-    //Split dataset based on feature and value
-    std::pair<std::vector<int>, std::vector<int>> splitData(const std::vector<Passenger>& data, const std::vector<int>& indices, int featureIdx, double splitValue, const std::string& splitCategory = "") {
-        std::vector<int> leftIndices, rightIndices;
-        for (int idx : indices) {
-            const Passenger& p = data[idx];
-            bool goLeft = false;
+    //Nodes of a subtree in preorder with their category sets and the (feature, gain) of every
+    //split search, in the same order
+    struct Subtree {
+        std::vector<TreeNode> nodes;
+        std::vector<uint64_t> categorySets;
+        std::vector<std::pair<int, double>> gains;
+    };
 
-            if (featureIdx == 0) { // pclass
-                goLeft = p.pclass <= splitValue;
-            }
-            else if (featureIdx == 1) { // sex
-                goLeft = (splitCategory.empty()) ? (p.sex == "female") : (p.sex == splitCategory);
-            }
-            else if (featureIdx == 2) { // age
-                goLeft = p.age <= splitValue && p.age >= 0;
-            }
-            else if (featureIdx == 3) { // sibSp
-                goLeft = p.sibSp <= splitValue;
-            }
-            else if (featureIdx == 4) { // parch
-                goLeft = p.parch <= splitValue;
-            }
-            else if (featureIdx == 5) { // fare
-                goLeft = p.fare <= splitValue && p.fare >= 0;
-            }
-            else if (featureIdx == 6) { // embarked
-                goLeft = (splitCategory.empty()) ? (p.embarked == "C") : (p.embarked == splitCategory);
+    //Working storage of one train call, released together when it returns. Nodes own ranges of
+    //the row arrays and partition them without allocating: a node at depth d holds its rows in
+    //buffer d % 2 and writes its children's rows to the same range of the other buffer, so nodes
+    //built concurrently never share storage. Count buffers (histograms, category counts) are recycled.
+    struct TrainingArena {
+        std::vector<int> rows[2]; //rows of the sample
+        std::vector<std::vector<int>> sorted[2]; //per feature, rows of the sample with a value of a numerical feature, in value order
+        std::vector<std::vector<unsigned>> spare;
+        std::mutex mutex;
+        TrainingTelemetry* telemetry = nullptr;
+
+        //Buffer of size zeroed counters
+        std::vector<unsigned> acquire(size_t size) {
+            std::vector<unsigned> buffer;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!spare.empty()) {
+                    buffer = std::move(spare.back());
+                    spare.pop_back();
+                }
             }
+            if (telemetry) telemetry->countBuffer(buffer.capacity() < size);
+            buffer.assign(size, 0);
+            return buffer;
+        }
 
-            if (goLeft) leftIndices.push_back(idx);
-            else rightIndices.push_back(idx);
+        void release(std::vector<unsigned>& buffer) {
+            if (buffer.capacity() == 0) return;
+            std::lock_guard<std::mutex> lock(mutex);
+            spare.push_back(std::move(buffer));
         }
+    };
+    TrainingArena* arena = nullptr; //set during train
 
-        return { leftIndices, rightIndices };
-    }
+    //Rows of a node: [begin, end) of the arena's row buffer side, and a range of each feature's sorted rows
+    struct NodeRows {
+        int side = 0;
+        size_t begin = 0, end = 0;
+        std::vector<size_t> sortedBegin, sortedEnd;
+    };
 
-    //Find best split for current node
-    std::tuple<int, double, std::string, double> findBestSplit(const std::vector<Passenger>& data, const std::vector<int>& indices) {
-        double bestGini = 1.0;
-        int bestFeature = -1;
-        double bestValue = 0.0;
-        std::string bestCategory = "";
+    //histogram mode training state
+    static constexpr uint8_t MissingBin = 255;
+    std::vector<std::vector<double>> binEdges; //per feature, largest training value in each bin
+    std::vector<std::vector<uint8_t>> binCodes; //per feature, bin of every row (MissingBin if no value)
+    std::vector<size_t> histOffset; //start of each feature's per-bin class counts in a node histogram
+
+    //level-wise training state: the nodes of the current level that are still to be split
+    struct PendingNode {
+        int32_t node;
+        int depth;
+        unsigned count0 = 0, count1 = 0;
+        std::tuple<int, double, std::vector<uint64_t>, double> split{ -1, 0.0, {}, 0.0 };
+        unsigned left0 = 0, left1 = 0; //class counts of the left side of split
+    };
+    std::vector<PendingNode> frontier;
+    std::vector<int32_t> frontierSlot; //per node, its index in frontier or -1
 
-        std::random_device rd;
-        std::mt19937 rng(rd());
 
-        // Get current labels
-        std::vector<bool> currentLabels;
-        for (int idx : indices) {
-            currentLabels.push_back(data[idx].survived);
+    //Gini impurity from class counts
+    static double calculateGini(unsigned count0, unsigned count1) {
+        unsigned size = count0 + count1;
+        if (size == 0) return 0.0;
+        double p0 = (double)(count0) / size;
+        double p1 = (double)(count1) / size;
+        return 1.0 - (p0 * p0 + p1 * p1);
+    }
+
+    //Codes of the categories with rows (counts holds count0, count1 per code), by ascending rate of
+    //class 1, ties by code. For two classes the best subset of categories to send left is a prefix
+    //of this order (Breiman), so one sweep over it replaces trying all 2^k subsets.
+    static std::vector<int> categoriesByRate(const unsigned* counts, int nCategories) {
+        std::vector<int> order;
+        for (int category = 0; category < nCategories; ++category) {
+            if (counts[2 * category] + counts[2 * category + 1] > 0) order.push_back(category);
         }
-        double parentGini = calculateGini(currentLabels);
+        std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+            uint64_t sizeA = counts[2 * a] + counts[2 * a + 1], sizeB = counts[2 * b] + counts[2 * b + 1];
+            return counts[2 * a + 1] * sizeB < counts[2 * b + 1] * sizeA;
+        });
+        return order;
+    }
 
-        if (featureSampleRatio > 1.0) featureSampleRatio = 1.0; //prevent failure incase a wrong value is passed.
+    //Extremely randomized trees: random 64-bit key of a feature's split, drawn in a fixed order
+    static uint64_t drawSplitKey(std::mt19937& rng) {
+        uint64_t high = rng();
+        return high << 32 | rng();
+    }
 
-        int nFeatures = std::max(1, (int)std::round(featureSampleRatio * 7));
+    //Extremely randomized trees: a bin drawn uniformly from [lowest, highest) of the non-empty bins,
+    //so a split at its edge has rows on both sides; -1 if fewer than two bins have rows
+    static int randomBin(const unsigned* counts, size_t nBins, uint64_t key) {
+        size_t lowest = nBins, highest = 0;
+        for (size_t b = 0; b < nBins; ++b) {
+            if (counts[2 * b] + counts[2 * b + 1] == 0) continue;
+            lowest = std::min(lowest, b);
+            highest = b;
+        }
+        if (lowest >= highest) return -1;
+        return (int)(lowest + hashMix(key) % (highest - lowest));
+    }
 
-        std::vector<int> featureIndices(7);
-        std::iota(std::begin(featureIndices), std::end(featureIndices), 0);
-        std::shuffle(std::begin(featureIndices), std::end(featureIndices), rng);
+    //Extremely randomized trees: move a random non-empty proper subset of the categories to the front
+    //of order and return its size (0 if there are fewer than two categories)
+    static size_t randomCategorySubset(std::vector<int>& order, uint64_t key) {
+        size_t k = order.size();
+        if (k < 2) return 0;
+        std::vector<char> left(k);
+        size_t nLeft = 0;
+        for (size_t i = 0; i < k; ++i) {
+            left[i] = (hashMix(key + 1 + i / 64) >> (i % 64)) & 1;
+            nLeft += left[i];
+        }
+        if (nLeft == 0 || nLeft == k) {
+            size_t flipped = hashMix(key) % k;
+            left[flipped] ^= 1;
+            nLeft = left[flipped] ? 1 : k - 1;
+        }
+        std::vector<int> subset;
+        for (size_t i = 0; i < k; ++i) if (left[i]) subset.push_back(order[i]);
+        for (size_t i = 0; i < k; ++i) if (!left[i]) subset.push_back(order[i]);
+        order.swap(subset);
+        return nLeft;
+    }
 
-        std::vector<int> chosenFeatures(std::begin(featureIndices), std::begin(featureIndices) + nFeatures);
+    const int* rowsOf(const NodeRows& node) const {
+        return arena->rows[node.side].data() + node.begin;
+    }
 
+    //Sum of the weights of the node's rows
+    unsigned sampleSize(const NodeRows& node) const {
+        const int* rows = rowsOf(node);
+        unsigned size = 0;
+        for (size_t i = 0; i < node.end - node.begin; ++i) size += weights[rows[i]];
+        return size;
+    }
 
-        // Try features
-        for (int featureIdx : chosenFeatures) {
-            // For numerical features
-            if (featureIdx == 0 || featureIdx == 2 || featureIdx == 3 || featureIdx == 4 || featureIdx == 5) {
-                // Try different split points
-                std::vector<double> values;
-                for (int idx : indices) {
-                    double value = 0.0;
-                    const Passenger& p = data[idx];
-
-                    if (featureIdx == 0) value = p.pclass;
-                    else if (featureIdx == 2) { if (p.age >= 0) value = p.age; else continue; }
-                    else if (featureIdx == 3) value = p.sibSp;
-                    else if (featureIdx == 4) value = p.parch;
-                    else if (featureIdx == 5) { if (p.fare >= 0) value = p.fare; else continue; }
-
-                    values.push_back(value);
-                }
+    //Quantize every numerical feature once before training. Features with at most maxBins
+    //distinct values get one bin per value; the others get equal-frequency bins over the
+    //weighted rows (sorted holds the rows of the sample in value order).
+    void buildBins(const Dataset& data, const std::vector<int>* sorted) {
+        int nBins = std::clamp(maxBins, 2, (int)MissingBin);
+        int nFeatures = data.featureCount();
+        binEdges.assign(nFeatures, {});
+        binCodes.assign(nFeatures, {});
+        histOffset.assign(nFeatures + 1, 0);
+        for (int featureIdx = 0; featureIdx < nFeatures; ++featureIdx) {
+            histOffset[featureIdx + 1] = histOffset[featureIdx];
+            if (featureSchema->isCategorical(featureIdx)) continue;
+            const std::vector<int>& column = data.column(featureIdx);
+            std::vector<std::pair<int, uint64_t>> valueCounts;
+            for (int idx : sorted[featureIdx]) {
+                if (valueCounts.empty() || valueCounts.back().first != column[idx]) valueCounts.emplace_back(column[idx], 0);
+                valueCounts.back().second += weights[idx];
+            }
+            std::vector<double>& edges = binEdges[featureIdx];
+            edges = HistogramLayout::quantileEdges(valueCounts, nBins);
 
-                if (values.empty()) continue;
+            std::vector<uint8_t>& codes = binCodes[featureIdx];
+            codes.resize(data.size());
+            int missingBelow = featureSchema->feature(featureIdx).missingBelow;
+            for (int idx = 0; idx < (int)data.size(); ++idx) {
+                int value = column[idx];
+                if (value >= missingBelow)
+                    codes[idx] = (uint8_t)(std::lower_bound(edges.begin(), edges.end(), (double)value) - edges.begin());
+                else
+                    codes[idx] = MissingBin;
+            }
+            histOffset[featureIdx + 1] += 2 * edges.size();
+        }
+    }
 
-                // Try unique values as potential splits
-                std::sort(values.begin(), values.end());
-                auto last = std::unique(values.begin(), values.end());
-                values.erase(last, values.end());
+    //Class counts per bin of every numerical feature over the node's rows
+    std::vector<unsigned> nodeHistogram(const Dataset& data, const NodeRows& node) {
+        TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Histogram);
+        std::vector<unsigned> histogram = arena->acquire(histOffset.back());
+        const std::vector<uint8_t>& labels = data.label();
+        const int* rows = rowsOf(node);
+        size_t count = node.end - node.begin;
+        for (int featureIdx = 0; featureIdx < data.featureCount(); ++featureIdx) {
+            if (featureSchema->isCategorical(featureIdx)) continue;
+            const std::vector<uint8_t>& codes = binCodes[featureIdx];
+            unsigned* counts = histogram.data() + histOffset[featureIdx];
+            for (size_t i = 0; i < count; ++i) {
+                int idx = rows[i];
+                uint8_t code = codes[idx];
+                if (code != MissingBin) counts[2 * code + labels[idx]] += weights[idx];
+            }
+        }
+        if (telemetry) telemetry->countHistogramRows(count);
+        return histogram;
+    }
 
-                for (double value : values) {
-                    auto [leftIndices, rightIndices] = splitData(data, indices, featureIdx, value);
+    //Best threshold or category subset of one feature of the given kind for a node, searched as described at
+    //findBestSplit; splitKey draws the split of extremely randomized trees
+    template <FeatureKind Kind>
+    SplitCandidate bestFeatureSplit(const Dataset& data, const NodeRows& node, const std::vector<unsigned>& histogram,
+        int featureIdx, unsigned total0, unsigned total1, uint64_t splitKey) const {
+        SplitCandidate best;
+        const std::vector<uint8_t>& labels = data.label();
+        unsigned size = total0 + total1;
+        uint64_t candidates = 0, scanned = 0;
 
-                    if (leftIndices.size() < minSamplesLeaf || rightIndices.size() < minSamplesLeaf) {
-                        continue;
-                    }
+        // Rows without a value always go right, so they only appear in the right counts
+        auto trySplit = [&](unsigned left0, unsigned left1, double value, int prefix) {
+            ++candidates;
+            unsigned leftSize = left0 + left1;
+            unsigned rightSize = size - leftSize;
+            if (leftSize < minSamplesLeaf || rightSize < minSamplesLeaf) return;
 
-                    // Calculate weighted Gini
-                    std::vector<bool> leftLabels, rightLabels;
-                    for (int idx : leftIndices) leftLabels.push_back(data[idx].survived);
-                    for (int idx : rightIndices) rightLabels.push_back(data[idx].survived);
+            // Calculate weighted Gini
+            double leftGini = calculateGini(left0, left1);
+            double rightGini = calculateGini(total0 - left0, total1 - left1);
 
-                    double leftGini = calculateGini(leftLabels);
-                    double rightGini = calculateGini(rightLabels);
+            double weightedGini = (leftSize * leftGini + rightSize * rightGini) / size;
 
-                    double weightedGini = (leftLabels.size() * leftGini + rightLabels.size() * rightGini) / indices.size();
+            if (weightedGini < best.gini) {
+                best.gini = weightedGini;
+                best.value = value;
+                best.prefix = prefix;
+            }
+        };
 
-                    if (weightedGini < bestGini) {
-                        bestGini = weightedGini;
-                        bestFeature = featureIdx;
-                        bestValue = value;
-                        bestCategory = "";
+        // For numerical features, binned
+        if constexpr (Kind == FeatureKind::Numeric) {
+            if (maxBins > 0) {
+                const std::vector<double>& edges = binEdges[featureIdx];
+                const unsigned* counts = histogram.data() + histOffset[featureIdx];
+                unsigned left0 = 0, left1 = 0;
+                if (extraTrees) {
+                    int bin = randomBin(counts, edges.size(), splitKey);
+                    for (int b = 0; b <= bin; ++b) {
+                        left0 += counts[2 * b];
+                        left1 += counts[2 * b + 1];
+                    }
+                    if (bin >= 0) trySplit(left0, left1, edges[bin], 0);
+                }
+                else {
+                    for (size_t b = 0; b < edges.size(); ++b) {
+                        if (counts[2 * b] + counts[2 * b + 1] == 0) continue;
+                        left0 += counts[2 * b];
+                        left1 += counts[2 * b + 1];
+                        trySplit(left0, left1, edges[b], 0);
                     }
                 }
             }
-            // For categorical features (sex, embarked)
-            else if (featureIdx == 1 || featureIdx == 6) {
-                std::unordered_map<std::string, int> categoryCounts;
-                for (int idx : indices) {
-                    std::string category;
-                    const Passenger& p = data[idx];
-
-                    if (featureIdx == 1) category = p.sex;
-                    else if (featureIdx == 6) category = p.embarked;
+            // For numerical features
+            else {
+                const int* order = arena->sorted[node.side][featureIdx].data() + node.sortedBegin[featureIdx];
+                size_t count = node.sortedEnd[featureIdx] - node.sortedBegin[featureIdx];
+                const std::vector<int>& column = data.column(featureIdx);
+                unsigned left0 = 0, left1 = 0;
+                if (extraTrees) {
+                    // One threshold drawn uniformly from the node's value range; values are integers, so a
+                    // threshold t in [lowest, highest) splits them as any real one in [t, t + 1) would
+                    if (count > 0 && column[order[0]] < column[order[count - 1]]) {
+                        int lowest = column[order[0]], highest = column[order[count - 1]];
+                        int threshold = lowest + (int)(hashMix(splitKey) % (uint64_t)((int64_t)highest - lowest));
+                        size_t k = 0;
+                        for (; k < count && column[order[k]] <= threshold; ++k) {
+                            if (labels[order[k]]) left1 += weights[order[k]];
+                            else left0 += weights[order[k]];
+                        }
+                        scanned = k;
+                        trySplit(left0, left1, threshold, 0);
+                    }
+                }
+                else {
+                    scanned = count;
+                    for (size_t k = 0; k < count; ++k) {
+                        if (labels[order[k]]) left1 += weights[order[k]];
+                        else left0 += weights[order[k]];
+                        int value = column[order[k]];
+                        if (k + 1 < count && column[order[k + 1]] == value) continue;
+                        trySplit(left0, left1, value, 0);
+                    }
+                }
+            }
+        }
+        // For categorical features
+        else {
+            // class counts per category code: count0, count1
+            int nCategories = data.dictionary(featureIdx).size();
+            std::vector<unsigned> categoryCounts = arena->acquire(2 * nCategories);
+            const std::vector<int>& column = data.column(featureIdx);
+            const int* rows = rowsOf(node);
+            scanned = node.end - node.begin;
+            for (size_t i = 0; i < node.end - node.begin; ++i) {
+                int idx = rows[i];
+                categoryCounts[2 * column[idx] + labels[idx]] += weights[idx];
+            }
 
-                    categoryCounts[category]++;
+            // Try each prefix of the categories in rate order as the left side (one random subset for extra trees)
+            std::vector<int> order = categoriesByRate(categoryCounts.data(), nCategories);
+            unsigned left0 = 0, left1 = 0;
+            if (extraTrees) {
+                size_t nLeft = randomCategorySubset(order, splitKey);
+                for (size_t k = 0; k < nLeft; ++k) {
+                    left0 += categoryCounts[2 * order[k]];
+                    left1 += categoryCounts[2 * order[k] + 1];
                 }
+                if (nLeft > 0) trySplit(left0, left1, 0.0, (int)nLeft);
+            }
+            else {
+                for (size_t k = 0; k + 1 < order.size(); ++k) {
+                    left0 += categoryCounts[2 * order[k]];
+                    left1 += categoryCounts[2 * order[k] + 1];
+                    trySplit(left0, left1, 0.0, (int)k + 1);
+                }
+            }
+            if (best.prefix > 0) best.categories = categoryBits(order.data(), best.prefix);
+            arena->release(categoryCounts);
+        }
+        if (telemetry) {
+            telemetry->countCandidates(featureIdx, candidates);
+            telemetry->countSplitRows(scanned);
+        }
+        return best;
+    }
 
-                // Try each category as a split
-                for (const auto& pair : categoryCounts) {
-                    if (pair.second < minSamplesLeaf) continue;
+    //Find best split for current node.
+    //Numerical features sweep the presorted rows once, keeping running class counts of the
+    //left side; every distinct value is a candidate threshold, exactly as a split on it would be.
+    //In histogram mode they sweep the node's per-bin class counts instead, one candidate per bin.
+    //Categorical features count the classes per category and sweep the categories in rate order
+    //(see categoriesByRate), one candidate per prefix.
+    //Extremely randomized trees try one candidate per feature instead: a threshold drawn uniformly
+    //from the node's range of the feature (a bin edge between its lowest and highest bins in histogram
+    //mode) or a random subset of its categories, which takes one pass over the node's rows at most.
+    //The sampled features are searched in parallel for large nodes; the first best in feature
+    //order wins either way. The gain is recorded in gains for featureImportance.
+    //Returns {feature, threshold, bits of the categories going left, weighted gini}.
+    std::tuple<int, double, std::vector<uint64_t>, double> findBestSplit(const Dataset& data, const NodeRows& node,
+        const std::vector<unsigned>& histogram, std::mt19937& nodeRng, std::vector<std::pair<int, double>>& gains) {
+        TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::SplitSearch);
+        const std::vector<uint8_t>& labels = data.label();
+        const int* rows = rowsOf(node);
+        size_t count = node.end - node.begin;
 
-                    auto [leftIndices, rightIndices] = splitData(data, indices, featureIdx, 0.0, pair.first);
+        // Get current class counts
+        unsigned total0 = 0, total1 = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (labels[rows[i]]) total1 += weights[rows[i]];
+            else total0 += weights[rows[i]];
+        }
+        if (telemetry) telemetry->countSplitRows(count);
+        double parentGini = calculateGini(total0, total1);
 
-                    if (leftIndices.size() < minSamplesLeaf || (indices.size() - leftIndices.size()) < minSamplesLeaf) {
-                        continue;
-                    }
+        int nFeatures = std::max(1, (int)std::round(featureSampleRatio * data.featureCount()));
 
-                    // Calculate weighted Gini
-                    std::vector<bool> leftLabels, rightLabels;
-                    for (int idx : leftIndices) leftLabels.push_back(data[idx].survived);
-                    for (int idx : rightIndices) rightLabels.push_back(data[idx].survived);
+        // the first nFeatures of a shuffled feature list
+        std::vector<int> chosenFeatures(data.featureCount());
+        std::iota(chosenFeatures.begin(), chosenFeatures.end(), 0);
+        std::shuffle(chosenFeatures.begin(), chosenFeatures.end(), nodeRng);
 
-                    double leftGini = calculateGini(leftLabels);
-                    double rightGini = calculateGini(rightLabels);
+        // random splits are drawn before the features are searched, possibly in parallel
+        std::vector<uint64_t> splitKeys(nFeatures, 0);
+        if (extraTrees) for (uint64_t& key : splitKeys) key = drawSplitKey(nodeRng);
 
-                    double weightedGini = (leftLabels.size() * leftGini + rightLabels.size() * rightGini) / indices.size();
+        // Try features, each with the kernel of its kind
+        std::vector<SplitCandidate> candidates(nFeatures);
+        auto searchFeature = [&](int i) {
+            int featureIdx = chosenFeatures[i];
+            candidates[i] = featureSchema->isCategorical(featureIdx)
+                ? bestFeatureSplit<FeatureKind::Categorical>(data, node, histogram, featureIdx, total0, total1, splitKeys[i])
+                : bestFeatureSplit<FeatureKind::Numeric>(data, node, histogram, featureIdx, total0, total1, splitKeys[i]);
+        };
+        if (pool && count >= ParallelSplitRows) pool->parallelFor(nFeatures, searchFeature);
+        else for (int i = 0; i < nFeatures; ++i) searchFeature(i);
 
-                    if (weightedGini < bestGini) {
-                        bestGini = weightedGini;
-                        bestFeature = featureIdx;
-                        bestValue = 0.0;
-                        bestCategory = pair.first;
-                    }
-                }
+        double bestGini = 1.0;
+        int best = -1;
+        for (int i = 0; i < nFeatures; ++i) {
+            if (candidates[i].gini < bestGini) {
+                bestGini = candidates[i].gini;
+                best = i;
             }
         }
         double gain = parentGini - bestGini;
-        featureImportance[bestFeature] += gain;
+        gains.emplace_back(best < 0 ? -1 : chosenFeatures[best], gain);
 
         // Only return if there's actual gain
         if (bestGini < parentGini) {
-            return { bestFeature, bestValue, bestCategory, bestGini };
+            return { chosenFeatures[best], candidates[best].value, std::move(candidates[best].categories), bestGini };
         }
 
-        return { -1, 0.0, "", 0.0 };
+        return { -1, 0.0, {}, 0.0 };
     }
 
-    TreeNode* buildTree(const std::vector<Passenger>& data, const std::vector<int>& indices, int depth) {
-        TreeNode* node = new TreeNode();
-        //check stopping criteria
-        if (depth >= maxDepth || indices.size() < minSamplesSplit) {
-            node->isLeaf = true;
-            //majority vote
-            int count0 = 0, count1 = 0;
-            for (int idx : indices) {
-                if (data[idx].survived) ++count1;
-                else ++count0;
+    //Set goesLeft for the rows by a split of the given kind; adds their weights to leftSize and rightSize
+    template <FeatureKind Kind>
+    void markRows(const int* column, const int* rows, size_t count, double splitValue, const std::vector<uint64_t>& categories,
+        int missingBelow, unsigned& leftSize, unsigned& rightSize) {
+        for (size_t i = 0; i < count; ++i) {
+            int idx = rows[i];
+            bool goLeft = SplitTest<Kind>::goesLeft(column[idx], splitValue, categories.data(), categories.size(), missingBelow);
+            goesLeft[idx] = goLeft;
+            if (goLeft) leftSize += weights[idx];
+            else rightSize += weights[idx];
+        }
+    }
+
+    //Divide the node's rows and sorted lists between its children, in the other buffer of the arena,
+    //keeping their order. Returns false, leaving the node as it is, if a side would have fewer than
+    //minSamplesLeaf samples.
+    bool partitionRows(const Dataset& data, const NodeRows& node, int featureIdx, double splitValue, const std::vector<uint64_t>& categories,
+        NodeRows& left, NodeRows& right) {
+        TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Partition);
+        const int* column = data.column(featureIdx).data();
+        int missingBelow = featureSchema->feature(featureIdx).missingBelow;
+        const int* rows = rowsOf(node);
+        size_t count = node.end - node.begin;
+        unsigned leftSize = 0, rightSize = 0;
+        if (featureSchema->isCategorical(featureIdx)) markRows<FeatureKind::Categorical>(column, rows, count, splitValue, categories, missingBelow, leftSize, rightSize);
+        else markRows<FeatureKind::Numeric>(column, rows, count, splitValue, categories, missingBelow, leftSize, rightSize);
+        if (leftSize < minSamplesLeaf || rightSize < minSamplesLeaf) {
+            for (size_t i = 0; i < count; ++i) goesLeft[rows[i]] = 0;
+            return false;
+        }
+
+        //stable split of from[begin, end) into to[begin, end), left rows first; returns where the right rows start
+        auto split = [&](const std::vector<int>& from, std::vector<int>& to, size_t begin, size_t end) {
+            size_t nLeft = 0;
+            for (size_t i = begin; i < end; ++i) nLeft += goesLeft[from[i]];
+            size_t l = begin, r = begin + nLeft;
+            for (size_t i = begin; i < end; ++i) {
+                int idx = from[i];
+                if (goesLeft[idx]) to[l++] = idx;
+                else to[r++] = idx;
             }
-            node->leafClass = count1 > count0;
-            return node;
+            return begin + nLeft;
+        };
+        int side = 1 - node.side;
+        left.side = right.side = side;
+        size_t middle = split(arena->rows[node.side], arena->rows[side], node.begin, node.end);
+        left.begin = node.begin;
+        left.end = right.begin = middle;
+        right.end = node.end;
+        uint64_t scanned = 2 * count;
+        int nFeatures = data.featureCount();
+        left.sortedBegin.resize(nFeatures);
+        left.sortedEnd.resize(nFeatures);
+        right.sortedBegin.resize(nFeatures);
+        right.sortedEnd.resize(nFeatures);
+        for (int f = 0; f < nFeatures; ++f) {
+            middle = split(arena->sorted[node.side][f], arena->sorted[side][f], node.sortedBegin[f], node.sortedEnd[f]);
+            left.sortedBegin[f] = node.sortedBegin[f];
+            left.sortedEnd[f] = right.sortedBegin[f] = middle;
+            right.sortedEnd[f] = node.sortedEnd[f];
+            scanned += node.sortedEnd[f] - node.sortedBegin[f];
+        }
+        for (size_t i = 0; i < count; ++i) goesLeft[rows[i]] = 0;
+        if (telemetry) telemetry->countPartitionRows(scanned);
+        return true;
+    }
+
+    //Majority class of the rows as a leaf at the end of the node array
+    int32_t addLeaf(const Dataset& data, const NodeRows& rows, Subtree& out) {
+        TreeNode leaf;
+        leaf.isLeaf = true;
+        //majority vote
+        unsigned count0 = 0, count1 = 0;
+        const int* indices = rowsOf(rows);
+        for (size_t i = 0; i < rows.end - rows.begin; ++i) {
+            if (data.label()[indices[i]]) count1 += weights[indices[i]];
+            else count0 += weights[indices[i]];
+        }
+        leaf.leafClass = count1 > count0;
+        out.nodes.push_back(leaf);
+        return (int32_t)out.nodes.size() - 1;
+    }
+
+    //Grow the subtree for the given rows in preorder at the end of out and return the index of its root.
+    //Each node samples features from its own stream, seeded by its position in the tree (nodeKey),
+    //so the children of a large node can be grown concurrently, the right one into a separate
+    //Subtree that is appended afterwards, and still give the serial result.
+    int32_t buildTree(const Dataset& data, const NodeRows& rows, std::vector<unsigned>& histogram, int depth, uint64_t nodeKey, Subtree& out) {
+        if (telemetry) telemetry->countNode(depth);
+        //check stopping criteria
+        if (depth >= maxDepth || sampleSize(rows) < minSamplesSplit) {
+            arena->release(histogram);
+            return addLeaf(data, rows, out);
         }
 
         //find best split
-        auto [featureIdx, splitValue, splitCategory, gini] = findBestSplit(data, indices);
-        if (featureIdx == -1) {
-            node->isLeaf = true;
-            //majority vote
-            int count0 = 0, count1 = 0;
-            for (int idx : indices) {
-                if (data[idx].survived) ++count1;
-                else ++count0;
+        std::mt19937 nodeRng((unsigned)(nodeKey ^ (nodeKey >> 32)));
+        auto [featureIdx, splitValue, categories, gini] = findBestSplit(data, rows, histogram, nodeRng, out.gains);
+
+        //split the data
+        NodeRows leftRows, rightRows;
+        if (featureIdx == -1 || !partitionRows(data, rows, featureIdx, splitValue, categories, leftRows, rightRows)) {
+            arena->release(histogram);
+            return addLeaf(data, rows, out);
+        }
+
+        //create internal node
+        int32_t node = (int32_t)out.nodes.size();
+        out.nodes.emplace_back();
+        out.nodes[node].featureIdx = (int16_t)featureIdx;
+        out.nodes[node].splitValue = splitValue;
+        if (featureSchema->isCategorical(featureIdx)) out.nodes[node].categorySet = appendCategorySet(out.categorySets, categories);
+        //histogram mode: scan only the smaller child, the larger one is the parent minus its sibling
+        size_t leftCount = leftRows.end - leftRows.begin, rightCount = rightRows.end - rightRows.begin;
+        std::vector<unsigned> leftHistogram, rightHistogram;
+        if (maxBins > 0) {
+            bool leftSmaller = leftCount <= rightCount;
+            std::vector<unsigned> smaller = nodeHistogram(data, leftSmaller ? leftRows : rightRows);
+            for (size_t i = 0; i < histogram.size(); ++i) histogram[i] -= smaller[i];
+            (leftSmaller ? leftHistogram : rightHistogram) = std::move(smaller);
+            (leftSmaller ? rightHistogram : leftHistogram) = std::move(histogram);
+        }
+        uint64_t leftKey = hashMix(2 * nodeKey), rightKey = hashMix(2 * nodeKey + 1);
+        int32_t left = -1, right = -1;
+        if (pool && std::min(leftCount, rightCount) >= ParallelSubtreeRows) {
+            Subtree rightTree;
+            pool->parallelFor(2, [&](int child) {
+                if (child == 0) left = buildTree(data, leftRows, leftHistogram, depth + 1, leftKey, out);
+                else buildTree(data, rightRows, rightHistogram, depth + 1, rightKey, rightTree);
+            });
+            right = (int32_t)out.nodes.size();
+            int32_t setBase = (int32_t)out.categorySets.size();
+            for (TreeNode child : rightTree.nodes) {
+                if (!child.isLeaf) {
+                    child.left += right;
+                    child.right += right;
+                }
+                if (child.categorySet >= 0) child.categorySet += setBase;
+                out.nodes.push_back(child);
             }
-            node->leafClass = count1 > count0;
-            return node;
+            out.categorySets.insert(out.categorySets.end(), rightTree.categorySets.begin(), rightTree.categorySets.end());
+            out.gains.insert(out.gains.end(), rightTree.gains.begin(), rightTree.gains.end());
+        }
+        else {
+            left = buildTree(data, leftRows, leftHistogram, depth + 1, leftKey, out);
+            right = buildTree(data, rightRows, rightHistogram, depth + 1, rightKey, out);
         }
+        out.nodes[node].left = left;
+        out.nodes[node].right = right;
+        return node;
+    }
 
-        //split the data
-        auto [leftIndices, rightIndices] = splitData(data, indices, featureIdx, splitValue, splitCategory);
-
-        if (leftIndices.size() < minSamplesLeaf || rightIndices.size() < minSamplesLeaf) {
-            node->isLeaf = true;
-            //majority vote
-            int count0 = 0, count1 = 0;
-            for (int idx : indices) {
-                if (data[idx].survived) ++count1;
-                else ++count0;
+    //Best split of a node from its level-wise histogram, searched as in histogram mode with the
+    //categorical features counted per bin as well. left0/left1 receive the left side's class counts.
+    std::tuple<int, double, std::vector<uint64_t>, double> findHistogramSplit(const HistogramLayout& layout, const unsigned* histogram,
+        unsigned& bestLeft0, unsigned& bestLeft1) {
+        double bestGini = 1.0;
+        int bestFeature = -1;
+        double bestValue = 0.0;
+        std::vector<int> bestOrder; //categorical: categories in rate order
+        int bestPrefix = 0;
+
+        unsigned total0 = histogram[layout.offset.back()];
+        unsigned total1 = histogram[layout.offset.back() + 1];
+        unsigned size = total0 + total1;
+        double parentGini = calculateGini(total0, total1);
+
+        if (featureSampleRatio > 1.0) featureSampleRatio = 1.0;
+
+        int featureCount = layout.schema->featureCount();
+        int nFeatures = std::max(1, (int)std::round(featureSampleRatio * featureCount));
+
+        std::vector<int> featureIndices(featureCount);
+        std::iota(std::begin(featureIndices), std::end(featureIndices), 0);
+        std::shuffle(std::begin(featureIndices), std::end(featureIndices), rng);
+
+        std::vector<int> chosenFeatures(std::begin(featureIndices), std::begin(featureIndices) + nFeatures);
+
+        TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::SplitSearch);
+        std::vector<uint64_t> candidates(featureCount, 0);
+        std::vector<int> order;
+        auto trySplit = [&](int featureIdx, unsigned left0, unsigned left1, double value, int prefix) {
+            ++candidates[featureIdx];
+            unsigned leftSize = left0 + left1;
+            unsigned rightSize = size - leftSize;
+            if (leftSize < minSamplesLeaf || rightSize < minSamplesLeaf) return;
+
+            double leftGini = calculateGini(left0, left1);
+            double rightGini = calculateGini(total0 - left0, total1 - left1);
+
+            double weightedGini = (leftSize * leftGini + rightSize * rightGini) / size;
+
+            if (weightedGini < bestGini) {
+                bestGini = weightedGini;
+                bestFeature = featureIdx;
+                bestValue = value;
+                if (prefix > 0) bestOrder = order;
+                bestPrefix = prefix;
+                bestLeft0 = left0;
+                bestLeft1 = left1;
+            }
+        };
+
+        for (int featureIdx : chosenFeatures) {
+            const unsigned* counts = histogram + layout.offset[featureIdx];
+            size_t nBins = (layout.offset[featureIdx + 1] - layout.offset[featureIdx]) / 2;
+            if (extraTrees) {
+                uint64_t key = drawSplitKey(rng);
+                unsigned left0 = 0, left1 = 0;
+                if (!layout.schema->isCategorical(featureIdx)) {
+                    int bin = randomBin(counts, nBins, key);
+                    for (int b = 0; b <= bin; ++b) {
+                        left0 += counts[2 * b];
+                        left1 += counts[2 * b + 1];
+                    }
+                    if (bin >= 0) trySplit(featureIdx, left0, left1, layout.edges[featureIdx][bin], 0);
+                }
+                else {
+                    order = categoriesByRate(counts, (int)nBins);
+                    size_t nLeft = randomCategorySubset(order, key);
+                    for (size_t k = 0; k < nLeft; ++k) {
+                        left0 += counts[2 * order[k]];
+                        left1 += counts[2 * order[k] + 1];
+                    }
+                    if (nLeft > 0) trySplit(featureIdx, left0, left1, 0.0, (int)nLeft);
+                }
+            }
+            else if (!layout.schema->isCategorical(featureIdx)) {
+                unsigned left0 = 0, left1 = 0;
+                for (size_t b = 0; b < nBins; ++b) {
+                    if (counts[2 * b] + counts[2 * b + 1] == 0) continue;
+                    left0 += counts[2 * b];
+                    left1 += counts[2 * b + 1];
+                    trySplit(featureIdx, left0, left1, layout.edges[featureIdx][b], 0);
+                }
+            }
+            else {
+                order = categoriesByRate(counts, (int)nBins);
+                unsigned left0 = 0, left1 = 0;
+                for (size_t k = 0; k + 1 < order.size(); ++k) {
+                    left0 += counts[2 * order[k]];
+                    left1 += counts[2 * order[k] + 1];
+                    trySplit(featureIdx, left0, left1, 0.0, (int)k + 1);
+                }
             }
-            node->leafClass = count1 > count0;
-            return node;
+            if (telemetry) telemetry->countCandidates(featureIdx, candidates[featureIdx]);
         }
+        double gain = parentGini - bestGini;
+        featureImportance[bestFeature] += gain;
 
-        //create internal node
-        node->isLeaf = false;
-        node->featureIdx = featureIdx;
-        node->splitValue = splitValue;
-        node->splitCategory = splitCategory;
-        node->left = buildTree(data, leftIndices, depth + 1);
-        node->right = buildTree(data, rightIndices, depth + 1);
+        if (bestGini < parentGini) {
+            return { bestFeature, bestValue, bestPrefix > 0 ? categoryBits(bestOrder.data(), bestPrefix) : std::vector<uint64_t>(), bestGini };
+        }
+
+        return { -1, 0.0, {}, 0.0 };
+    }
+
+    //Node of the next level: a leaf straight away if it meets a stopping criterion, otherwise pending
+    int32_t addPending(int depth, unsigned count0, unsigned count1, std::vector<PendingNode>& next) {
+        int32_t node = (int32_t)nodes.size();
+        nodes.emplace_back();
+        nodes[node].isLeaf = true;
+        nodes[node].leafClass = count1 > count0;
+        frontierSlot.push_back(-1);
+        if (telemetry) telemetry->countNode(depth);
+        if (depth < maxDepth && count0 + count1 >= minSamplesSplit) {
+            frontierSlot[node] = (int32_t)next.size();
+            PendingNode pending{ node, depth };
+            pending.count0 = count0;
+            pending.count1 = count1;
+            next.push_back(pending);
+        }
         return node;
     }
 
-    int countLeaves(const TreeNode* node) const {
-        if (!node) return 0;
-        if (node->isLeaf) return 1;
-        return countLeaves(node->left) + countLeaves(node->right);
+    //Leaf that a stored row reaches (a pending node during level-wise training); the dataset's
+    //category codes must be the tree's
+    int32_t leafOf(const Dataset& data, size_t row) const {
+        int32_t at = 0;
+        while (!nodes[at].isLeaf) {
+            const TreeNode& node = nodes[at];
+            int value = data.column(node.featureIdx)[row];
+            bool goLeft = node.categorySet >= 0
+                ? SplitTest<FeatureKind::Categorical>::goesLeft(value, 0.0, categorySets.data() + node.categorySet + 1, categorySets[node.categorySet], 0)
+                : SplitTest<FeatureKind::Numeric>::goesLeft(value, node.splitValue, nullptr, 0, featureSchema->feature(node.featureIdx).missingBelow);
+            at = goLeft ? node.left : node.right;
+        }
+        return at;
     }
 
-    int treeDepth(const TreeNode* node) const {
-        if (!node) return 0;
-        if (node->isLeaf) return 1;
-        return 1 + std::max(treeDepth(node->left), treeDepth(node->right));
+    //Copy the subtree at node to the end of ordered in preorder and return its new index
+    int32_t appendPreorder(int32_t node, std::vector<TreeNode>& ordered) const {
+        int32_t at = (int32_t)ordered.size();
+        ordered.push_back(nodes[node]);
+        if (!nodes[node].isLeaf) {
+            int32_t left = appendPreorder(nodes[node].left, ordered);
+            int32_t right = appendPreorder(nodes[node].right, ordered);
+            ordered[at].left = left;
+            ordered[at].right = right;
+        }
+        return at;
     }
 
-    void copyTree(TreeNode*& toNode, TreeNode* fromNode) {
-        if (!fromNode) toNode = nullptr;
+    //As appendPreorder, with every split whose subtrees predict one class replaced by a leaf of that class
+    int32_t appendCollapsed(int32_t node, std::vector<TreeNode>& ordered) const {
+        int32_t at = (int32_t)ordered.size();
+        ordered.push_back(nodes[node]);
+        if (nodes[node].isLeaf) return at;
+        int32_t left = appendCollapsed(nodes[node].left, ordered);
+        int32_t right = appendCollapsed(nodes[node].right, ordered);
+        if (ordered[left].isLeaf && ordered[right].isLeaf && ordered[left].leafClass == ordered[right].leafClass) {
+            //two leaf children are the last two nodes
+            ordered[at] = ordered[left];
+            ordered.resize(at + 1);
+        }
         else {
-            toNode = new TreeNode;
-            toNode->featureIdx = fromNode->featureIdx;
-            toNode->splitValue = fromNode->splitValue;
-            toNode->splitCategory = fromNode->splitCategory;
-            toNode->isLeaf = fromNode->isLeaf;
-            toNode->leafClass = fromNode->leafClass;
-            copyTree(toNode->left, fromNode->left);
-            copyTree(toNode->right, fromNode->right);
+            ordered[at].left = left;
+            ordered[at].right = right;
         }
+        return at;
     }
 
-    void destroy(TreeNode*& node) {
-        if (node != nullptr) {
-            destroy(node->left);
-            destroy(node->right);
-            delete node;
-            node = nullptr;
-        }
+    int countLeaves(int32_t node) const {
+        if (node < 0) return 0;
+        if (nodes[node].isLeaf) return 1;
+        return countLeaves(nodes[node].left) + countLeaves(nodes[node].right);
+    }
+
+    int treeDepth(int32_t node) const {
+        if (node < 0) return 0;
+        if (nodes[node].isLeaf) return 1;
+        return 1 + std::max(treeDepth(nodes[node].left), treeDepth(nodes[node].right));
     }
 
-    void serialize(std::fstream& model_file, TreeNode* node) {
-        // Handle nullptr nodes
-        if (node == nullptr) {
+    //The file format is the original pointer-tree one: nodes in preorder, each behind a null marker
+    void serialize(std::fstream& model_file, int32_t node) {
+        // Handle missing nodes
+        if (node < 0) {
             bool is_null = true;
             model_file.write(reinterpret_cast<const char*>(&is_null), sizeof(is_null));
             return;
         }
+        const TreeNode& n = nodes[node];
         // Mark this node as not null
         bool is_null = false;
         model_file.write(reinterpret_cast<const char*>(&is_null), sizeof(is_null));
-        model_file.write(reinterpret_cast<const char*>(&node->featureIdx), sizeof(node->featureIdx));
-        model_file.write(reinterpret_cast<const char*>(&node->splitValue), sizeof(node->splitValue));
-        size_t s = node->splitCategory.size();
+        int featureIdx = n.featureIdx;
+        model_file.write(reinterpret_cast<const char*>(&featureIdx), sizeof(featureIdx));
+        //a categorical split on one category keeps the original form: splitValue 0 and the category;
+        //others store the number of categories as splitValue and each with its length, in string order
+        double splitValue = n.splitValue;
+        std::string splitCategory;
+        if (n.categorySet >= 0) {
+            std::vector<std::string> names;
+            for (int code : leftCategories(n)) names.push_back(categories[featureIdx]->decode(code));
+            std::sort(names.begin(), names.end());
+            if (names.size() == 1 && !names[0].empty()) {
+                splitCategory = names[0];
+            }
+            else {
+                splitValue = (double)names.size();
+                for (const std::string& category : names) {
+                    size_t length = category.size();
+                    splitCategory.append(reinterpret_cast<const char*>(&length), sizeof(length));
+                    splitCategory += category;
+                }
+            }
+        }
+        model_file.write(reinterpret_cast<const char*>(&splitValue), sizeof(splitValue));
+        size_t s = splitCategory.size();
         model_file.write(reinterpret_cast<const char*>(&s), sizeof(s));
         if (s > 0) {
-            model_file.write(node->splitCategory.c_str(), s);
+            model_file.write(splitCategory.c_str(), s);
         }
-        model_file.write(reinterpret_cast<const char*>(&node->isLeaf), sizeof(node->isLeaf));
-        model_file.write(reinterpret_cast<const char*>(&node->leafClass), sizeof(node->leafClass));
+        model_file.write(reinterpret_cast<const char*>(&n.isLeaf), sizeof(n.isLeaf));
+        model_file.write(reinterpret_cast<const char*>(&n.leafClass), sizeof(n.leafClass));
         //serialize children recursively
-        if (!node->isLeaf) {
-            serialize(model_file, node->left);
-            serialize(model_file, node->right);
+        if (!n.isLeaf) {
+            serialize(model_file, n.left);
+            serialize(model_file, n.right);
         }
     }
 
-    TreeNode* deserialize(std::fstream& model_file) {
+    //Split categories are encoded into the dictionaries of the given dataset
+    int32_t deserialize(std::fstream& model_file, Dataset& dictionaries) {
         bool is_null = false;
         model_file.read(reinterpret_cast<char*>(&is_null), sizeof(is_null));
-        if (is_null) {
-            return nullptr;
+        if (is_null || !model_file) {
+            return -1;
         }
-        TreeNode* node = new TreeNode();
-        model_file.read(reinterpret_cast<char*>(&node->featureIdx), sizeof(node->featureIdx));
-        model_file.read(reinterpret_cast<char*>(&node->splitValue), sizeof(node->splitValue));
-        size_t s;
+        TreeNode n;
+        int featureIdx = -1;
+        model_file.read(reinterpret_cast<char*>(&featureIdx), sizeof(featureIdx));
+        n.featureIdx = (int16_t)featureIdx;
+        model_file.read(reinterpret_cast<char*>(&n.splitValue), sizeof(n.splitValue));
+        size_t s = 0;
         model_file.read(reinterpret_cast<char*>(&s), sizeof(s));
+        if (featureIdx < -1 || featureIdx >= featureSchema->featureCount() || (s > 0 && (featureIdx < 0 || !featureSchema->isCategorical(featureIdx)))) {
+            model_file.setstate(std::ios::failbit); //written for another feature schema
+            return -1;
+        }
         if (s > 0) {
-            node->splitCategory.resize(s);
-            model_file.read(reinterpret_cast<char*>(&node->splitCategory[0]), s);
+            std::string splitCategory(s, '\0');
+            model_file.read(reinterpret_cast<char*>(&splitCategory[0]), s);
+            std::vector<int> codes;
+            if (n.splitValue == 0) {
+                codes.push_back(dictionaries.encodeCategory(featureIdx, splitCategory));
+            }
+            else {
+                size_t at = 0;
+                for (double k = 0; k < n.splitValue && at + sizeof(size_t) <= s; ++k) {
+                    size_t length = 0;
+                    std::memcpy(&length, splitCategory.data() + at, sizeof(length));
+                    at += sizeof(length);
+                    if (length > s - at) break;
+                    codes.push_back(dictionaries.encodeCategory(featureIdx, splitCategory.substr(at, length)));
+                    at += length;
+                }
+                if (at != s || (double)codes.size() != n.splitValue) {
+                    model_file.setstate(std::ios::failbit);
+                    return -1;
+                }
+            }
+            n.splitValue = 0.0;
+            n.categorySet = appendCategorySet(categorySets, categoryBits(codes.data(), codes.size()));
         }
-        model_file.read(reinterpret_cast<char*>(&node->isLeaf), sizeof(node->isLeaf));
-        model_file.read(reinterpret_cast<char*>(&node->leafClass), sizeof(node->leafClass));
+        model_file.read(reinterpret_cast<char*>(&n.isLeaf), sizeof(n.isLeaf));
+        model_file.read(reinterpret_cast<char*>(&n.leafClass), sizeof(n.leafClass));
+        int32_t node = (int32_t)nodes.size();
+        nodes.push_back(n);
         //deserialize children recursively
-        if (!node->isLeaf) {
-            node->left = deserialize(model_file);
-            node->right = deserialize(model_file);
+        if (!n.isLeaf) {
+            int32_t left = deserialize(model_file, dictionaries);
+            int32_t right = left < 0 ? -1 : deserialize(model_file, dictionaries);
+            if (featureIdx < 0 || right < 0) {
+                model_file.setstate(std::ios::failbit); //truncated, or a split without a feature or child
+                return -1;
+            }
+            nodes[node].left = left;
+            nodes[node].right = right;
         }
         return node;
     }
+
+    //minSamplesSplit or minSamplesLeaf of a model file, where they are ints
+    static unsigned readSampleCount(std::fstream& model_file) {
+        int count = 0;
+        model_file.read(reinterpret_cast<char*>(&count), sizeof(count));
+        return (unsigned)std::max(0, count);
+    }
+
+    //Drop the nodes and take the schema and dictionaries of the given dataset
+    void resetModel(const Dataset& dictionaries) {
+        nodes.clear();
+        levelCount = 0;
+        categorySets.clear();
+        featureSchema = dictionaries.schema();
+        titanicSchema = featureSchema->isTitanic();
+        categories.assign(featureSchema->featureCount(), nullptr);
+        for (int featureIdx = 0; featureIdx < featureSchema->featureCount(); ++featureIdx) {
+            if (featureSchema->isCategorical(featureIdx)) categories[featureIdx] = dictionaries.sharedDictionary(featureIdx);
+        }
+    }
     
 public:
-    DecisionTree(int maxDepth = 5, int minSamplesSplit = 2, int minSamplesLeaf = 1, double featureSampleRatio = 1.0) :
-        root(nullptr), maxDepth(maxDepth), minSamplesSplit(minSamplesSplit), minSamplesLeaf(minSamplesLeaf), featureSampleRatio(featureSampleRatio) {}
-
-    DecisionTree(const DecisionTree& other) {
-        if (!other.root)
-            root = nullptr;
-        else
-            copyTree(root, other.root);
-        maxDepth = other.maxDepth;
-        minSamplesSplit = other.minSamplesSplit;
-        minSamplesLeaf = other.minSamplesLeaf;
-        featureSampleRatio = other.featureSampleRatio;
-        featureImportance = other.featureImportance;
-    }
-
-    DecisionTree operator=(const DecisionTree& other) {
-        if (!other.root)
-            root = nullptr;
-        else
-            copyTree(root, other.root);
-        maxDepth = other.maxDepth;
-        minSamplesSplit = other.minSamplesSplit;
-        minSamplesLeaf = other.minSamplesLeaf;
-        featureSampleRatio = other.featureSampleRatio;
-        featureImportance = other.featureImportance;
-        return *this;
-    }
-
-    ~DecisionTree() {
-        destroy(root);
+    //maxBins > 0 trains on histograms of at most maxBins (<= 255) bins per numerical feature instead of exact values.
+    //nThreads != 1 trains on that many threads (<= 0: every hardware thread), with the same result as serial training.
+    //Negative minSamplesSplit or minSamplesLeaf set no limit, as 0 does.
+    //extraTrees grows an extremely randomized tree: every sampled feature is tried at one random threshold
+    //or category subset only, and the best of those is taken (see findBestSplit).
+    DecisionTree(int maxDepth = 5, int minSamplesSplit = 2, int minSamplesLeaf = 1, double featureSampleRatio = 1.0, int maxBins = 0, int nThreads = 1,
+        bool extraTrees = false) :
+        maxDepth(maxDepth), minSamplesSplit((unsigned)std::max(0, minSamplesSplit)), minSamplesLeaf((unsigned)std::max(0, minSamplesLeaf)),
+        featureSampleRatio(featureSampleRatio), maxBins(maxBins), nThreads(nThreads), extraTrees(extraTrees) {
+        resetModel(Dataset());
     }
 
     void train(const std::vector<Passenger>& data) {
-        std::vector<int> indices(data.size());
-        std::iota(std::begin(indices), std::end(indices), 0);
-        root = buildTree(data, indices, 0);
-        /* std::cout << "Tree depth: " << treeDepth(root)
-             << ", Leaves: " << countLeaves(root) << "\n";*/
+        std::random_device rd;
+        train(Dataset(data), rd());
+    }
+
+    void train(const std::vector<Passenger>& data, unsigned seed) {
+        train(Dataset(data), seed);
+    }
+
+    //Train with a fixed seed; the same seed and data always give the same tree
+    void train(const Dataset& data, unsigned seed) {
+        train(data, std::vector<unsigned>(data.size(), 1), presortFeatures(data), seed);
+    }
+
+    //Train on a weighted sample of the rows: rowWeights[i] is the number of times row i is in
+    //the sample (a bootstrap count; 0 leaves it out), and splits count every row that many times.
+    //sorted is presortFeatures(data), which can be shared by all trees trained on data.
+    void train(const Dataset& data, std::vector<unsigned> rowWeights, const std::vector<std::vector<int>>& sorted, unsigned seed) {
+        TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::TreeBuild);
+        resetModel(data);
+        if (featureSampleRatio > 1.0) featureSampleRatio = 1.0; //prevent failure incase a wrong value is passed.
+        int nFeatures = data.featureCount();
+        weights = std::move(rowWeights);
+        TrainingArena storage;
+        storage.telemetry = telemetry;
+        arena = &storage;
+        for (int idx = 0; idx < (int)data.size(); ++idx) {
+            if (weights[idx] > 0) storage.rows[0].push_back(idx);
+        }
+        storage.rows[1].resize(storage.rows[0].size());
+        storage.sorted[0].resize(nFeatures);
+        storage.sorted[1].resize(nFeatures);
+        for (int featureIdx = 0; featureIdx < nFeatures; ++featureIdx) {
+            for (int idx : sorted[featureIdx]) {
+                if (weights[idx] > 0) storage.sorted[0][featureIdx].push_back(idx);
+            }
+        }
+        goesLeft.assign(data.size(), 0);
+        NodeRows root;
+        root.end = storage.rows[0].size();
+        root.sortedBegin.assign(nFeatures, 0);
+        root.sortedEnd.assign(nFeatures, 0);
+        std::vector<unsigned> histogram;
+        if (maxBins > 0) {
+            {
+                TrainingTelemetry::PhaseTimer binTimer(telemetry, TrainingPhase::Binning);
+                buildBins(data, storage.sorted[0].data());
+            }
+            histogram = nodeHistogram(data, root);
+            for (std::vector<int>& list : storage.sorted[0]) list.clear();
+        }
+        for (int featureIdx = 0; featureIdx < nFeatures; ++featureIdx) {
+            root.sortedEnd[featureIdx] = storage.sorted[0][featureIdx].size();
+            storage.sorted[1][featureIdx].resize(root.sortedEnd[featureIdx]);
+        }
+        Subtree tree;
+        if (nThreads != 1) {
+            ThreadPool threads(nThreads);
+            pool = &threads;
+            buildTree(data, root, histogram, 0, hashMix(seed), tree);
+            pool = nullptr;
+        }
+        else {
+            buildTree(data, root, histogram, 0, hashMix(seed), tree);
+        }
+        arena = nullptr;
+        nodes = std::move(tree.nodes);
+        categorySets = std::move(tree.categorySets);
+        levelCount = treeDepth(0);
+        for (const auto& [featureIdx, gain] : tree.gains) featureImportance[featureIdx] += gain;
+        goesLeft.clear();
+        weights.clear();
+        binEdges.clear();
+        binCodes.clear();
+        /* std::cout << "Tree depth: " << treeDepth(0)
+             << ", Leaves: " << countLeaves(0) << "\n";*/
+    }
+
+    //Indices of all rows with a value for each numerical feature, sorted by that value.
+    //Built once per training set; buildTree keeps each node's share in the same order.
+    static std::vector<std::vector<int>> presortFeatures(const Dataset& data) {
+        std::vector<std::vector<int>> sorted(data.featureCount());
+        for (int featureIdx = 0; featureIdx < data.featureCount(); ++featureIdx) {
+            if (data.schema()->isCategorical(featureIdx)) continue;
+            std::vector<std::pair<double, int>> keyed;
+            const std::vector<int>& column = data.column(featureIdx);
+            int missingBelow = data.schema()->feature(featureIdx).missingBelow;
+            for (int idx = 0; idx < (int)data.size(); ++idx) {
+                if (column[idx] >= missingBelow) keyed.emplace_back(column[idx], idx);
+            }
+            std::sort(keyed.begin(), keyed.end());
+            sorted[featureIdx].reserve(keyed.size());
+            for (const auto& entry : keyed) sorted[featureIdx].push_back(entry.second);
+        }
+        return sorted;
+    }
+
+    //Level-wise training, for data that is only seen in passes over chunks (see RandomForest::trainStreaming).
+    //The tree grows one level per round: the caller routes every row to its pending node with
+    //pendingIndex, accumulates one histogram per pending node and hands them to choosePendingSplit,
+    //then calls nextLevel. Category codes are those of schema's dictionaries.
+    void beginLevelwise(const Dataset& schema, unsigned seed) {
+        rng.seed(seed);
+        resetModel(schema);
+        nodes.emplace_back();
+        nodes[0].isLeaf = true;
+        if (telemetry) telemetry->countNode(0);
+        frontier = { PendingNode{ 0, 0 } };
+        frontierSlot = { 0 };
+    }
+
+    int pendingCount() const {
+        return (int)frontier.size();
+    }
+
+    //Pending node a row of the chunk falls into, -1 if it ends in a finished leaf
+    int pendingIndex(const Dataset& chunk, size_t row) const {
+        return frontierSlot[leafOf(chunk, row)];
+    }
+
+    //Decide the split of a pending node from the histogram of its rows; it is applied by nextLevel
+    void choosePendingSplit(int index, const HistogramLayout& layout, const unsigned* histogram) {
+        PendingNode& pending = frontier[index];
+        pending.count0 = histogram[layout.offset.back()];
+        pending.count1 = histogram[layout.offset.back() + 1];
+        if (pending.depth >= maxDepth || pending.count0 + pending.count1 < minSamplesSplit) return;
+        pending.split = findHistogramSplit(layout, histogram, pending.left0, pending.left1);
+    }
+
+    //Decision of choosePendingSplit for a pending node, to replay it with setPendingSplit on a
+    //copy of the tree that routes other rows (see RandomForest::trainDistributed)
+    struct PendingSplit {
+        unsigned count0 = 0, count1 = 0, left0 = 0, left1 = 0;
+        int featureIdx = -1;
+        double splitValue = 0.0;
+        std::vector<uint64_t> categories; //bits of the categories going left, empty for numerical splits
+    };
+
+    PendingSplit pendingSplit(int index) const {
+        const PendingNode& pending = frontier[index];
+        const auto& [featureIdx, splitValue, categories, gini] = pending.split;
+        return { pending.count0, pending.count1, pending.left0, pending.left1, featureIdx, splitValue, categories };
+    }
+
+    void setPendingSplit(int index, const PendingSplit& split) {
+        PendingNode& pending = frontier[index];
+        pending.count0 = split.count0;
+        pending.count1 = split.count1;
+        pending.left0 = split.left0;
+        pending.left1 = split.left1;
+        pending.split = { split.featureIdx, split.splitValue, split.categories, 0.0 };
+    }
+
+    //Apply the chosen splits, making the children the new pending nodes. Returns false once the
+    //tree is complete, when the nodes are put back in preorder.
+    bool nextLevel() {
+        std::vector<PendingNode> next;
+        for (const PendingNode& pending : frontier) {
+            const auto& [featureIdx, splitValue, categories, gini] = pending.split;
+            frontierSlot[pending.node] = -1;
+            nodes[pending.node].leafClass = pending.count1 > pending.count0;
+            unsigned right0 = pending.count0 - pending.left0, right1 = pending.count1 - pending.left1;
+            if (featureIdx == -1 || pending.left0 + pending.left1 < minSamplesLeaf || right0 + right1 < minSamplesLeaf) continue;
+
+            nodes[pending.node].isLeaf = false;
+            nodes[pending.node].featureIdx = (int16_t)featureIdx;
+            nodes[pending.node].splitValue = splitValue;
+            if (featureSchema->isCategorical(featureIdx)) nodes[pending.node].categorySet = appendCategorySet(categorySets, categories);
+            int32_t left = addPending(pending.depth + 1, pending.left0, pending.left1, next);
+            int32_t right = addPending(pending.depth + 1, right0, right1, next);
+            nodes[pending.node].left = left;
+            nodes[pending.node].right = right;
+        }
+        frontier = std::move(next);
+        if (!frontier.empty()) return true;
+
+        std::vector<TreeNode> ordered;
+        ordered.reserve(nodes.size());
+        appendPreorder(0, ordered);
+        nodes = std::move(ordered);
+        levelCount = treeDepth(0);
+        frontierSlot.clear();
+        return false;
+    }
+
+    //Record training counters and phase times in telemetry from now on (nullptr: stop recording).
+    //The telemetry must outlive the training calls.
+    void setTelemetry(TrainingTelemetry* training) {
+        telemetry = training;
+    }
+
+    //Feature values of a passenger as the nodes compare them: codes of the given Sex and Embarked
+    //dictionaries (-1 if unseen) and NaN for missing values, which never go left
+    static void encodeRow(const Passenger& p, const CategoryDictionary& sexes, const CategoryDictionary& ports, double* row) {
+        const double missing = std::numeric_limits<double>::quiet_NaN();
+        row[PClass] = p.pclass;
+        row[Sex] = sexes.find(p.sex);
+        row[Age] = isMissingValue(Age, p.age) ? missing : p.age;
+        row[SibSp] = p.sibSp;
+        row[Parch] = p.parch;
+        row[Fare] = isMissingValue(Fare, p.fare) ? missing : p.fare;
+        row[Embarked] = ports.find(p.embarked);
+    }
+
+    //Walk a non-empty node array with its category sets for one encoded row
+    static bool walk(const TreeNode* nodes, const uint64_t* categorySets, const double* row) {
+        const TreeNode* node = nodes;
+        while (!node->isLeaf) {
+            double value = row[node->featureIdx];
+            bool goLeft = node->categorySet >= 0 ? inCategorySet(categorySets, node->categorySet, (int)value) : value <= node->splitValue;
+            node = nodes + (goLeft ? node->left : node->right);
+        }
+        return node->leafClass;
+    }
+
+    //Batch walk of a non-empty node array: adds its prediction to votes[r] for r in [0, count).
+    //columns[f] holds the block's values of feature f, encoded as for walk. All rows advance one
+    //level per pass and a row that reached a leaf stays there, so the inner loop has no
+    //data-dependent exits and the compiler can vectorize it.
+    static void walkBlock(const TreeNode* nodes, const uint64_t* categorySets, const double* const* columns, int count, int levels,
+        int32_t* cursor, int* votes) {
+        std::fill(cursor, cursor + count, 0);
+        for (int level = 1; level < levels; ++level) {
+            for (int r = 0; r < count; ++r) {
+                int32_t at = cursor[r];
+                const TreeNode& node = nodes[at];
+                int feature = node.isLeaf ? 0 : node.featureIdx;
+                double value = columns[feature][r];
+                bool goLeft = node.categorySet >= 0 ? inCategorySet(categorySets, node.categorySet, (int)value) : value <= node.splitValue;
+                int32_t next = goLeft ? node.left : node.right;
+                cursor[r] = node.isLeaf ? at : next;
+            }
+        }
+        for (int r = 0; r < count; ++r) votes[r] += nodes[cursor[r]].leafClass ? 1 : 0;
     }
 
+    //Throws std::runtime_error if the tree was not trained on the Titanic schema
     bool predict(const Passenger& p) const {
-        const TreeNode* node = root;
-        while (node && !node->isLeaf) {
-            bool goLeft = false;
-            if (node->featureIdx == 0) // pclass
-                goLeft = p.pclass <= node->splitValue;
-            else if (node->featureIdx == 1) // sex
-                goLeft = p.sex == node->splitCategory;
-            else if (node->featureIdx == 2) // age
-                goLeft = p.age <= node->splitValue && p.age >= 0;
-            else if (node->featureIdx == 3) // sibSp
-                goLeft = p.sibSp <= node->splitValue;
-            else if (node->featureIdx == 4) // parch
-                goLeft = p.parch <= node->splitValue;
-            else if (node->featureIdx == 5) // fare
-                goLeft = p.fare <= node->splitValue && p.fare >= 0;
-            else if (node->featureIdx == 6) // embarked
-                goLeft = p.embarked == node->splitCategory;
-            node = goLeft ? node->left : node->right;
-        }
-        return node ? node->leafClass : false;
+        if (!titanicSchema) throw std::runtime_error("passengers can only be predicted by trees of the Titanic schema");
+        if (nodes.empty()) return false;
+        double row[NumFeatures];
+        encodeRow(p, *categories[Sex], *categories[Embarked], row);
+        return walk(nodes.data(), categorySets.data(), row);
+    }
+
+    //Prediction for a row of the dataset the tree was trained on (or one sharing its category dictionaries)
+    bool predict(const Dataset& data, size_t row) const {
+        if (nodes.empty()) return false;
+        return nodes[leafOf(data, row)].leafClass;
+    }
+
+    //Number of node levels on the longest root-to-leaf path (0 for an untrained tree)
+    int depth() const {
+        return levelCount;
+    }
+
+    //Every split has a feature, a category set within the tree's sets exactly when it is
+    //categorical, and children after it in the node array, so every walk ends at a leaf; a check
+    //of a tree read from a file
+    bool isWellFormed() const {
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const TreeNode& node = nodes[i];
+            if (node.isLeaf) continue;
+            if (node.featureIdx < 0 || node.featureIdx >= featureSchema->featureCount()) return false;
+            if (node.left <= (int32_t)i || node.right <= (int32_t)i || node.left >= (int32_t)nodes.size() || node.right >= (int32_t)nodes.size()) return false;
+            if ((node.categorySet >= 0) != featureSchema->isCategorical(node.featureIdx)) return false;
+            if (node.categorySet >= 0 && ((size_t)node.categorySet >= categorySets.size()
+                || categorySets[node.categorySet] > categorySets.size() - node.categorySet - 1)) return false;
+        }
+        return true;
+    }
+
+    //Strings behind the category codes of a categorical feature's split nodes
+    const CategoryDictionary& getCategories(int featureIdx) const {
+        return *categories[featureIdx];
+    }
+
+    //Replace every split whose subtrees predict the same class for every input by a leaf of that
+    //class, bottom up, so predictions do not change. Returns the number of nodes removed.
+    int collapseRedundantSplits() {
+        if (nodes.empty()) return 0;
+        std::vector<TreeNode> collapsed;
+        collapsed.reserve(nodes.size());
+        appendCollapsed(0, collapsed);
+        int removed = (int)(nodes.size() - collapsed.size());
+        //keep only the category sets of the remaining splits
+        std::vector<uint64_t> sets;
+        for (TreeNode& node : collapsed) {
+            if (node.isLeaf || node.categorySet < 0) continue;
+            const uint64_t* set = categorySets.data() + node.categorySet;
+            node.categorySet = appendCategorySet(sets, std::vector<uint64_t>(set + 1, set + 1 + set[0]));
+        }
+        nodes.swap(collapsed);
+        categorySets.swap(sets);
+        levelCount = treeDepth(0);
+        return removed;
+    }
+
+    //Batch inference over a block of rows: adds this tree's prediction to votes[r] for r in [0, count).
+    //columns[f] holds the block's values of feature f in this tree's category codes (see walkBlock).
+    void voteBlock(const double* const* columns, int count, int levels, int32_t* cursor, int* votes) const {
+        if (nodes.empty()) return;
+        walkBlock(nodes.data(), categorySets.data(), columns, count, levels, cursor, votes);
+    }
+
+    //Node array in preorder, root first (empty for an untrained tree)
+    const std::vector<TreeNode>& getNodes() const {
+        return nodes;
+    }
+
+    //Sets of the categorical splits, see TreeNode::categorySet
+    const std::vector<uint64_t>& getCategorySets() const {
+        return categorySets;
+    }
+
+    //Codes of the categories going left at a categorical split node of this tree, ascending
+    std::vector<int> leftCategories(const TreeNode& node) const {
+        std::vector<int> codes;
+        if (node.categorySet < 0) return codes;
+        uint64_t words = categorySets[node.categorySet];
+        for (int code = 0; code < (int)(64 * words); ++code) {
+            if (inCategorySet(categorySets.data(), node.categorySet, code)) codes.push_back(code);
+        }
+        return codes;
+    }
+
+    //Features of the data the tree was trained on (the Titanic schema if loaded from a file without one)
+    const std::shared_ptr<const FeatureSchema>& schema() const {
+        return featureSchema;
     }
 
     std::unordered_map<int, double> getFeatureImportance() const {
         return featureImportance;
     }
 
+    //A tree of a schema other than the Titanic one starts with it (see FeatureSchema::writeModelHeader)
     void save(const std::string& model_file) {
         std::fstream file(model_file, std::ios::out | std::ios::binary);
+        featureSchema->writeModelHeader(file);
         file.write(reinterpret_cast<const char*>(&maxDepth), sizeof(maxDepth));
         file.write(reinterpret_cast<const char*>(&minSamplesSplit), sizeof(minSamplesSplit));
         file.write(reinterpret_cast<const char*>(&minSamplesLeaf), sizeof(minSamplesLeaf));
         file.write(reinterpret_cast<const char*>(&featureSampleRatio), sizeof(featureSampleRatio));
-        serialize(file, root);
+        serialize(file, nodes.empty() ? -1 : 0);
         file.close();
     }
     void save(std::fstream& model_file_obj) {
@@ -482,23 +1416,40 @@ public:
         model_file_obj.write(reinterpret_cast<const char*>(&minSamplesSplit), sizeof(minSamplesSplit));
         model_file_obj.write(reinterpret_cast<const char*>(&minSamplesLeaf), sizeof(minSamplesLeaf));
         model_file_obj.write(reinterpret_cast<const char*>(&featureSampleRatio), sizeof(featureSampleRatio));
-        serialize(model_file_obj, root);
+        serialize(model_file_obj, nodes.empty() ? -1 : 0);
     }
 
-    void load(const std::string& model_file) {
+    //The tree takes the schema of the file; if schema is given the file's must equal it.
+    //Throws std::runtime_error if the schemas differ or the file's is corrupt; a node of a
+    //feature the schema does not have fails the stream.
+    void load(const std::string& model_file, std::shared_ptr<const FeatureSchema> schema = nullptr) {
         std::fstream file(model_file, std::ios::in | std::ios::binary);
+        schema = FeatureSchema::readModelHeader(file, std::move(schema));
         file.read(reinterpret_cast<char*>(&maxDepth), sizeof(maxDepth));
-        file.read(reinterpret_cast<char*>(&minSamplesSplit), sizeof(minSamplesSplit));
-        file.read(reinterpret_cast<char*>(&minSamplesLeaf), sizeof(minSamplesLeaf));
+        minSamplesSplit = readSampleCount(file);
+        minSamplesLeaf = readSampleCount(file);
         file.read(reinterpret_cast<char*>(&featureSampleRatio), sizeof(featureSampleRatio));
-        root = deserialize(file);
+        Dataset dictionaries(std::move(schema));
+        resetModel(dictionaries);
+        deserialize(file, dictionaries);
+        levelCount = treeDepth(nodes.empty() ? -1 : 0);
         file.close();
     }
-    void load(std::fstream& model_file_obj) {
+    //Tree of a forest's model file, which records the schema once for all trees
+    void load(std::fstream& model_file_obj, std::shared_ptr<const FeatureSchema> schema) {
+        Dataset dictionaries(std::move(schema));
+        load(model_file_obj, dictionaries);
+    }
+    //Split categories go into the dictionaries of the given dataset, whose schema the file must have;
+    //the tree then shares them, so trees loaded with the same dataset share one dictionary per feature.
+    //A node of an unknown feature, or a split missing a child, fails the stream.
+    void load(std::fstream& model_file_obj, Dataset& dictionaries) {
         model_file_obj.read(reinterpret_cast<char*>(&maxDepth), sizeof(maxDepth));
-        model_file_obj.read(reinterpret_cast<char*>(&minSamplesSplit), sizeof(minSamplesSplit));
-        model_file_obj.read(reinterpret_cast<char*>(&minSamplesLeaf), sizeof(minSamplesLeaf));
+        minSamplesSplit = readSampleCount(model_file_obj);
+        minSamplesLeaf = readSampleCount(model_file_obj);
         model_file_obj.read(reinterpret_cast<char*>(&featureSampleRatio), sizeof(featureSampleRatio));
-        root = deserialize(model_file_obj);
+        resetModel(dictionaries);
+        deserialize(model_file_obj, dictionaries);
+        levelCount = treeDepth(nodes.empty() ? -1 : 0);
     }
 };
\ No newline at end of file
@@ -0,0 +1,53 @@
+// Checks that training does not depend on the thread count:
+//   DeterminismTest [titanic.csv]
+// Forests (trees trained in parallel) and single trees (nodes split in parallel) are trained with the
+// same seed on 1, 3 and 8 threads, in exact and histogram mode; every saved model must be byte-identical
+// to the one trained on 1 thread. Prints the differences and returns 1 if there are any.
+#include "CsvLoader.h"
+#include "RandomForest.h"
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char* argv[]) {
+    std::string dataFile = argc > 1 ? argv[1] : "titanic.csv";
+    std::string modelFile = "determinism_test.bin";
+    int failures = 0, checks = 0;
+    try {
+        Dataset data = CsvLoader::load(dataFile);
+        for (int maxBins : { 0, 32 }) {
+            std::string forestBytes, treeBytes;
+            for (int nThreads : { 1, 3, 8 }) {
+                RandomForest forest(24, 8, 2, 1, 0.7, maxBins, nThreads, 42);
+                forest.train(data);
+                forest.save(modelFile);
+                std::string bytes = readFile(modelFile);
+                if (nThreads == 1) forestBytes = bytes;
+                else if (bytes != forestBytes) {
+                    std::cerr << "forest with maxBins " << maxBins << " differs on " << nThreads << " threads\n";
+                    ++failures;
+                }
+
+                DecisionTree tree(12, 2, 1, 0.7, maxBins, nThreads);
+                tree.train(data, 7u);
+                tree.save(modelFile);
+                bytes = readFile(modelFile);
+                if (nThreads == 1) treeBytes = bytes;
+                else if (bytes != treeBytes) {
+                    std::cerr << "tree with maxBins " << maxBins << " differs on " << nThreads << " threads\n";
+                    ++failures;
+                }
+                checks += 2;
+            }
+        }
+        std::cout << checks << " models trained, " << failures << " differences" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        ++failures;
+    }
+    std::remove(modelFile.c_str());
+    return failures == 0 ? 0 : 1;
+}
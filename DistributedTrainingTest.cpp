@@ -0,0 +1,99 @@
+// Check that data-parallel training gives the forest of out-of-core training:
+//   DistributedTrainingTest [titanic.csv]
+// Splits the csv into 3 shards, trains with trainDistributed on workers running trainShard on
+// threads (connected by socket pairs) and with trainStreaming over the shards concatenated, in
+// 0 and 32 bin mode; the saved models must be byte-identical. Prints the differences and returns
+// 1 if there are any.
+#include "CsvLoader.h"
+#include "RandomForest.h"
+#include "TrainingChannel.h"
+#include <csignal>
+#include <thread>
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char* argv[]) {
+    std::string dataFile = argc > 1 ? argv[1] : "titanic.csv";
+    const int nShards = 3;
+    std::vector<std::string> shardFiles;
+    for (int s = 0; s < nShards; ++s) shardFiles.push_back("distributed_test_shard" + std::to_string(s) + ".csv");
+    std::string wholeFile = "distributed_test_whole.csv", modelFile = "distributed_test.bin";
+    std::signal(SIGPIPE, SIG_IGN);
+    int failures = 0, checks = 0;
+    try {
+        std::ifstream in(dataFile);
+        if (!in.is_open()) throw std::runtime_error("cannot open " + dataFile);
+        std::string header, line;
+        std::getline(in, header);
+        std::vector<std::string> records;
+        while (std::getline(in, line)) records.push_back(line);
+        std::ofstream whole(wholeFile, std::ios::binary);
+        whole << header << "\n";
+        for (int s = 0; s < nShards; ++s) {
+            std::ofstream shard(shardFiles[s], std::ios::binary);
+            shard << header << "\n";
+            for (size_t r = records.size() * s / nShards; r < records.size() * (s + 1) / nShards; ++r) {
+                shard << records[r] << "\n";
+                whole << records[r] << "\n";
+            }
+        }
+        whole.close();
+
+        for (int maxBins : { 0, 32 }) {
+            RandomForest streamed(12, 6, 2, 2, 0.7, maxBins, 2, 42);
+            CsvChunkReader reader(wholeFile, 4096);
+            streamed.trainStreaming(reader);
+            streamed.save(modelFile);
+            std::string expected = readFile(modelFile);
+
+            std::vector<FdChannel> workers;
+            std::vector<std::thread> threads;
+            std::vector<std::string> workerErrors(nShards);
+            for (int s = 0; s < nShards; ++s) {
+                auto [coordinatorEnd, workerEnd] = FdChannel::socketPair();
+                workers.push_back(std::move(coordinatorEnd));
+                threads.emplace_back([&, s, channel = std::move(workerEnd)]() mutable {
+                    try {
+                        RandomForest::trainShard(CsvLoader::load(shardFiles[s], 1), channel, 1);
+                    }
+                    catch (const std::exception& e) {
+                        workerErrors[s] = e.what();
+                    }
+                });
+            }
+            RandomForest distributed(12, 6, 2, 2, 0.7, maxBins, 2, 42);
+            std::string coordinatorError;
+            try {
+                distributed.trainDistributed(workers);
+            }
+            catch (const std::exception& e) {
+                coordinatorError = e.what();
+            }
+            workers.clear();
+            for (std::thread& thread : threads) thread.join();
+            for (int s = 0; s < nShards; ++s) {
+                if (!workerErrors[s].empty()) coordinatorError += "; worker " + std::to_string(s) + ": " + workerErrors[s];
+            }
+            if (!coordinatorError.empty()) throw std::runtime_error(coordinatorError);
+
+            distributed.save(modelFile);
+            if (readFile(modelFile) != expected) {
+                std::cerr << "trainDistributed with maxBins " << maxBins << " differs from trainStreaming\n";
+                ++failures;
+            }
+            ++checks;
+        }
+        std::cout << checks << " forests compared, " << failures << " differences" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        ++failures;
+    }
+    for (const std::string& file : shardFiles) std::remove(file.c_str());
+    std::remove(wholeFile.c_str());
+    std::remove(modelFile.c_str());
+    return failures == 0 ? 0 : 1;
+}
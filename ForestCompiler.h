@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdio>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "RandomForest.h"
+
+//Generates a self-contained C++ source file from a trained forest.
+//Every tree becomes a function of nested comparisons with its thresholds and category codes
+//baked in as constants, so the compiler can inline and branch-optimize the whole model.
+//The generated predict gives the same answer as RandomForest::predict for every input.
+class ForestCompiler {
+private:
+    const RandomForest& forest;
+    CategoryDictionary categories[NumFeatures]; //categories of all trees under one set of codes
+
+    static void indent(std::ostream& out, int depth) {
+        for (int i = 0; i < depth; ++i) out << "    ";
+    }
+
+    //Hexadecimal literal, so the threshold is reproduced bit for bit
+    static std::string exactLiteral(double value) {
+        char buffer[64];
+        std::snprintf(buffer, sizeof(buffer), "%a", value);
+        return buffer;
+    }
+
+    static std::string quoted(const std::string& text) {
+        std::string result = "\"";
+        for (unsigned char c : text) {
+            if (c == '"' || c == '\\') {
+                result += '\\';
+                result += (char)c;
+            }
+            else if (c < 0x20 || c >= 0x7f) {
+                char buffer[8];
+                std::snprintf(buffer, sizeof(buffer), "\\%03o", c);
+                result += buffer;
+            }
+            else result += (char)c;
+        }
+        return result + "\"";
+    }
+
+    void emitNode(std::ostream& out, const DecisionTree& tree, int32_t index, int depth) const {
+        const TreeNode& node = tree.getNodes()[index];
+        if (node.isLeaf) {
+            indent(out, depth);
+            out << "return " << (node.leafClass ? "true" : "false") << ";\n";
+            return;
+        }
+        indent(out, depth);
+        if (node.categorySet >= 0) {
+            //one comparison per category going left
+            std::string test, comment;
+            for (int code : tree.leftCategories(node)) {
+                const std::string& category = tree.getCategories(node.featureIdx).decode(code);
+                test += std::string(test.empty() ? "" : " || ") + "x[" + std::to_string(node.featureIdx) + "] == "
+                    + std::to_string(categories[node.featureIdx].find(category));
+                comment += (comment.empty() ? "" : ", ") + quoted(category);
+            }
+            out << "if (" << (test.empty() ? "false" : test) << ") { // " << featureName(node.featureIdx) << " in {" << comment << "}\n";
+        }
+        else {
+            out << "if (x[" << node.featureIdx << "] <= " << exactLiteral(node.splitValue) << ") { // "
+                << featureName(node.featureIdx) << " <= " << node.splitValue << "\n";
+        }
+        emitNode(out, tree, node.left, depth + 1);
+        indent(out, depth);
+        out << "}\n";
+        emitNode(out, tree, node.right, depth);
+    }
+
+    void emitCategoryFunction(std::ostream& out, int featureIdx) const {
+        out << "inline int " << featureName(featureIdx) << "Code(const std::string& value) {\n";
+        for (int code = 0; code < categories[featureIdx].size(); ++code)
+            out << "    if (value == " << quoted(categories[featureIdx].decode(code)) << ") return " << code << ";\n";
+        out << "    return -1;\n}\n\n";
+    }
+
+public:
+    //Throws std::runtime_error if the forest is not of the Titanic schema, whose predict(Passenger) is generated
+    explicit ForestCompiler(const RandomForest& forest) : forest(forest) {
+        if (!forest.schema()->isTitanic()) throw std::runtime_error("only forests of the Titanic schema can be compiled");
+        for (const DecisionTree& tree : forest.getTrees()) {
+            for (const TreeNode& node : tree.getNodes()) {
+                for (int code : tree.leftCategories(node)) categories[node.featureIdx].encode(tree.getCategories(node.featureIdx).decode(code));
+            }
+        }
+    }
+
+    //Write the generated source; its functions live in namespace ns
+    void generate(std::ostream& out, const std::string& ns, const std::string& source = "") const {
+        const std::vector<DecisionTree>& trees = forest.getTrees();
+        out << "// Generated by ForestCompiler" << (source.empty() ? "" : " from " + source) << ". Do not edit.\n";
+        out << "#pragma once\n\n#include <cmath>\n#include <string>\n\n";
+        out << "namespace " << ns << " {\n\n";
+        out << "constexpr int NumTrees = " << trees.size() << ";\n\n";
+
+        for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+            if (isCategoricalFeature(featureIdx)) emitCategoryFunction(out, featureIdx);
+        }
+
+        out << "//x holds pclass, sex, age, sibSp, parch, fare, embarked; categorical features as the codes\n"
+            << "//returned above and missing values as NaN\n";
+        for (size_t t = 0; t < trees.size(); ++t) {
+            out << "inline bool tree" << t << "(const double* x) {\n";
+            if (trees[t].getNodes().empty()) out << "    return false;\n";
+            else emitNode(out, trees[t], 0, 1);
+            out << "}\n\n";
+        }
+
+        out << "//Number of trees voting survived\n";
+        out << "inline int votes(const double* x) {\n    int count = 0;\n";
+        for (size_t t = 0; t < trees.size(); ++t) out << "    count += tree" << t << "(x);\n";
+        out << "    return count;\n}\n\n";
+
+        out << "inline bool predictEncoded(const double* x) {\n    return 2 * votes(x) > NumTrees;\n}\n\n";
+
+        out << "//Any type with the Passenger fields used by the model\n";
+        out << "template <typename Row>\ninline bool predict(const Row& p) {\n";
+        out << "    double x[" << NumFeatures << "] = {\n"
+            << "        (double)p.pclass,\n"
+            << "        (double)sexCode(p.sex),\n"
+            << "        p.age < 0 ? NAN : (double)p.age,\n"
+            << "        (double)p.sibSp,\n"
+            << "        (double)p.parch,\n"
+            << "        p.fare < 0 ? NAN : (double)p.fare,\n"
+            << "        (double)embarkedCode(p.embarked)\n"
+            << "    };\n";
+        out << "    return predictEncoded(x);\n}\n\n";
+        out << "} // namespace " << ns << "\n";
+    }
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//Read-only memory mapping of a whole file. Throws std::runtime_error if the file cannot be mapped.
+class MappedFile {
+private:
+    const char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    void release() {
+#ifdef _WIN32
+        if (bytes) UnmapViewOfFile(bytes);
+        if (mapping) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+        mapping = nullptr;
+#else
+        if (bytes) munmap(const_cast<char*>(bytes), length);
+        if (fd >= 0) close(fd);
+        fd = -1;
+#endif
+        bytes = nullptr;
+        length = 0;
+    }
+
+    void fail(const std::string& path, const char* what) {
+        release();
+        throw std::runtime_error("cannot map " + path + ": " + what);
+    }
+
+public:
+    explicit MappedFile(const std::string& path) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) fail(path, "cannot open");
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) fail(path, "cannot stat");
+        length = (size_t)size.QuadPart;
+        if (length == 0) return;
+        mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping) fail(path, "CreateFileMapping failed");
+        bytes = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!bytes) fail(path, "MapViewOfFile failed");
+#else
+        fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail(path, "cannot open");
+        struct stat info;
+        if (fstat(fd, &info) != 0) fail(path, "cannot stat");
+        length = (size_t)info.st_size;
+        if (length == 0) return;
+        void* address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        if (address == MAP_FAILED) {
+            bytes = nullptr;
+            fail(path, "mmap failed");
+        }
+        bytes = static_cast<const char*>(address);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        release();
+    }
+
+    const char* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+};
@@ -0,0 +1,371 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "RandomForest.h"
+
+//Memory-mapped model format (version 2). All integers are in the writer's byte order.
+//
+//  ModelFileHeader                      at offset 0
+//  per tree: node array                 TreeNode records, 64-byte aligned
+//            category sets              uint64 words right behind the nodes (see TreeNode::categorySet)
+//  index                                at header.indexOffset:
+//      ModelTreeEntry[treeCount]
+//      category table                   per feature: uint32 count, then per category uint32 length + bytes
+//
+//Category codes in the sets refer to the file's category table, which is shared by all trees.
+//Version 1 held a single category code per node and is not read; its forests can be saved again.
+//The index sits behind the node arrays, so trees can be appended (see append): the new node arrays
+//and a new index go to the end of the file and the header is updated in place; the old index is left
+//behind as unused bytes.
+
+constexpr char ModelFileMagic[8] = { 'R', 'F', 'M', 'O', 'D', 'E', 'L', '\0' };
+constexpr uint32_t ModelFileVersion = 2;
+constexpr uint32_t ModelFileByteOrder = 0x01020304; //reads back differently on a machine of the other endianness
+constexpr size_t ModelFileAlignment = 64;
+
+struct ModelFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t nodeSize; //sizeof(TreeNode)
+    uint32_t featureCount;
+    uint32_t treeCount;
+    uint32_t reserved0;
+    uint64_t indexOffset;
+    uint64_t indexSize;
+    uint8_t reserved[16];
+};
+
+struct ModelTreeEntry {
+    uint64_t nodeOffset;
+    uint32_t nodeCount;
+    uint32_t depth; //node levels on the longest path, used by batch inference
+    uint64_t setOffset;
+    uint32_t setWords; //size of the category sets in uint64 words
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ModelFileHeader) == 64, "ModelFileHeader layout is part of the file format");
+static_assert(sizeof(ModelTreeEntry) == 32, "ModelTreeEntry layout is part of the file format");
+static_assert(sizeof(TreeNode) == 24 && offsetof(TreeNode, left) == 8 && offsetof(TreeNode, right) == 12
+    && offsetof(TreeNode, featureIdx) == 16 && offsetof(TreeNode, isLeaf) == 18 && offsetof(TreeNode, leafClass) == 19
+    && offsetof(TreeNode, categorySet) == 20, "TreeNode layout is part of the file format");
+
+
+//A forest used for inference straight from a memory-mapped model file.
+//Opening maps the file, checks it and reads the header and the small category table; nodes are
+//never copied. Appending to the file while it is mapped is safe: append only adds bytes and
+//rewrites the header, so an open MappedForest keeps serving the trees it was opened with.
+class MappedForest {
+private:
+    MappedFile file;
+    ModelFileHeader header; //copied at open: append rewrites the header of a file that may be mapped
+    const ModelTreeEntry* entries = nullptr;
+    CategoryDictionary categories[NumFeatures];
+
+    static void pad(std::ostream& out, size_t alignment) {
+        static const char zeros[ModelFileAlignment] = {};
+        size_t position = (size_t)out.tellp();
+        size_t padding = (alignment - position % alignment) % alignment;
+        out.write(zeros, padding);
+    }
+
+    //Node record with padding bytes zeroed, so identical models give identical files
+    static void appendNode(std::vector<char>& buffer, const TreeNode& node) {
+        char record[sizeof(TreeNode)] = {};
+        std::memcpy(record + offsetof(TreeNode, splitValue), &node.splitValue, sizeof(node.splitValue));
+        std::memcpy(record + offsetof(TreeNode, left), &node.left, sizeof(node.left));
+        std::memcpy(record + offsetof(TreeNode, right), &node.right, sizeof(node.right));
+        std::memcpy(record + offsetof(TreeNode, featureIdx), &node.featureIdx, sizeof(node.featureIdx));
+        std::memcpy(record + offsetof(TreeNode, isLeaf), &node.isLeaf, sizeof(node.isLeaf));
+        std::memcpy(record + offsetof(TreeNode, leafClass), &node.leafClass, sizeof(node.leafClass));
+        std::memcpy(record + offsetof(TreeNode, categorySet), &node.categorySet, sizeof(node.categorySet));
+        buffer.insert(buffer.end(), record, record + sizeof(record));
+    }
+
+    [[noreturn]] void corrupt(const char* what) const {
+        throw std::runtime_error(std::string("invalid model file: ") + what);
+    }
+
+    template <typename T>
+    T readIndex(size_t& position) const {
+        if (position + sizeof(T) > file.size()) corrupt("truncated index");
+        T value;
+        std::memcpy(&value, file.data() + position, sizeof(T));
+        position += sizeof(T);
+        return value;
+    }
+
+    //Child indices must point forward inside the tree (so every walk ends at a leaf), category sets
+    //must lie inside the tree's and the stored depth must be exact, since batch inference walks that many levels
+    void checkTree(const ModelTreeEntry& entry, std::vector<uint32_t>& levels) const {
+        if (entry.nodeOffset % ModelFileAlignment != 0 || entry.nodeOffset > header.indexOffset
+            || entry.nodeCount > (header.indexOffset - entry.nodeOffset) / sizeof(TreeNode)) corrupt("node array out of range");
+        if (entry.setOffset % sizeof(uint64_t) != 0 || entry.setOffset > header.indexOffset
+            || entry.setWords > (header.indexOffset - entry.setOffset) / sizeof(uint64_t)) corrupt("category sets out of range");
+        const TreeNode* nodes = reinterpret_cast<const TreeNode*>(file.data() + entry.nodeOffset);
+        const uint64_t* sets = reinterpret_cast<const uint64_t*>(file.data() + entry.setOffset);
+        uint32_t depth = 0;
+        levels.assign(entry.nodeCount, 0);
+        if (entry.nodeCount > 0) levels[0] = 1;
+        for (uint32_t i = 0; i < entry.nodeCount; ++i) {
+            const TreeNode& node = nodes[i];
+            if (levels[i] == 0) corrupt("unreachable node");
+            depth = std::max(depth, levels[i]);
+            if (node.isLeaf) continue;
+            if (node.left <= (int32_t)i || node.right <= (int32_t)i || node.left >= (int32_t)entry.nodeCount
+                || node.right >= (int32_t)entry.nodeCount) corrupt("child index out of range");
+            if (node.featureIdx < 0 || node.featureIdx >= NumFeatures) corrupt("feature index out of range");
+            if ((node.categorySet >= 0) != isCategoricalFeature(node.featureIdx)) corrupt("split kind does not match the feature");
+            if (node.categorySet >= 0 && ((uint32_t)node.categorySet >= entry.setWords || sets[node.categorySet] > entry.setWords - node.categorySet - 1))
+                corrupt("category set out of range");
+            levels[node.left] = levels[i] + 1;
+            levels[node.right] = levels[i] + 1;
+        }
+        if (depth != entry.depth) corrupt("wrong tree depth");
+    }
+
+    //Add the categories that trees [begin, end) split on to the file's table
+    static void collectCategories(const std::vector<DecisionTree>& trees, size_t begin, CategoryDictionary* fileCategories) {
+        for (size_t t = begin; t < trees.size(); ++t) {
+            for (const TreeNode& node : trees[t].getNodes()) {
+                for (int code : trees[t].leftCategories(node))
+                    fileCategories[node.featureIdx].encode(trees[t].getCategories(node.featureIdx).decode(code));
+            }
+        }
+    }
+
+    //Write the node arrays and category sets of trees [begin, end) at the current position, adding their index entries
+    static void writeTrees(std::ostream& out, const std::vector<DecisionTree>& trees, size_t begin, const CategoryDictionary* fileCategories,
+        std::vector<ModelTreeEntry>& treeEntries) {
+        std::vector<char> buffer;
+        std::vector<uint64_t> sets;
+        std::vector<int> codes;
+        for (size_t t = begin; t < trees.size(); ++t) {
+            const DecisionTree& tree = trees[t];
+            pad(out, ModelFileAlignment);
+            ModelTreeEntry entry = {};
+            entry.nodeOffset = (uint64_t)out.tellp();
+            entry.nodeCount = (uint32_t)tree.getNodes().size();
+            entry.depth = (uint32_t)tree.depth();
+            buffer.clear();
+            sets.clear();
+            for (TreeNode node : tree.getNodes()) {
+                if (node.categorySet >= 0) {
+                    codes.clear();
+                    for (int code : tree.leftCategories(node))
+                        codes.push_back(fileCategories[node.featureIdx].find(tree.getCategories(node.featureIdx).decode(code)));
+                    node.categorySet = appendCategorySet(sets, categoryBits(codes.data(), codes.size()));
+                }
+                appendNode(buffer, node);
+            }
+            out.write(buffer.data(), buffer.size());
+            entry.setOffset = (uint64_t)out.tellp();
+            entry.setWords = (uint32_t)sets.size();
+            out.write(reinterpret_cast<const char*>(sets.data()), sets.size() * sizeof(uint64_t));
+            treeEntries.push_back(entry);
+        }
+    }
+
+    //Write the index at the next aligned position and point the header at it
+    static void writeIndex(std::ostream& out, const std::vector<ModelTreeEntry>& treeEntries, const CategoryDictionary* fileCategories,
+        ModelFileHeader& fileHeader) {
+        pad(out, ModelFileAlignment);
+        fileHeader.indexOffset = (uint64_t)out.tellp();
+        out.write(reinterpret_cast<const char*>(treeEntries.data()), treeEntries.size() * sizeof(ModelTreeEntry));
+        for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+            const CategoryDictionary& dictionary = fileCategories[featureIdx];
+            uint32_t count = (uint32_t)dictionary.size();
+            out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            for (int code = 0; code < dictionary.size(); ++code) {
+                const std::string& category = dictionary.decode(code);
+                uint32_t length = (uint32_t)category.size();
+                out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+                out.write(category.data(), length);
+            }
+        }
+        fileHeader.indexSize = (uint64_t)out.tellp() - fileHeader.indexOffset;
+        fileHeader.treeCount = (uint32_t)treeEntries.size();
+    }
+
+public:
+    //Write a forest in the mapped format; throws std::runtime_error if it is not of the Titanic schema.
+    //The file is replaced, so a file that others have mapped must be written under another name and
+    //renamed over it
+    static void save(const RandomForest& forest, const std::string& model_file) {
+        if (!forest.schema()->isTitanic()) throw std::runtime_error("the mapped format holds forests of the Titanic schema only");
+        const std::vector<DecisionTree>& trees = forest.getTrees();
+
+        //one category table for the whole file
+        CategoryDictionary fileCategories[NumFeatures];
+        collectCategories(trees, 0, fileCategories);
+
+        std::ofstream out(model_file, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.is_open()) throw std::runtime_error("cannot write " + model_file);
+        ModelFileHeader fileHeader = {};
+        out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+        std::vector<ModelTreeEntry> treeEntries;
+        writeTrees(out, trees, 0, fileCategories, treeEntries);
+        writeIndex(out, treeEntries, fileCategories, fileHeader);
+
+        std::memcpy(fileHeader.magic, ModelFileMagic, sizeof(ModelFileMagic));
+        fileHeader.version = ModelFileVersion;
+        fileHeader.byteOrder = ModelFileByteOrder;
+        fileHeader.nodeSize = sizeof(TreeNode);
+        fileHeader.featureCount = NumFeatures;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        if (!out) throw std::runtime_error("cannot write " + model_file);
+    }
+
+    //Append trees [firstTree, end) of forest to a model file that holds its first firstTree trees,
+    //without rewriting them. The header is written last, so an interrupted append leaves the file
+    //as it was. Throws std::runtime_error if the file is not a valid model of firstTree trees.
+    static void append(const RandomForest& forest, size_t firstTree, const std::string& model_file) {
+        if (!forest.schema()->isTitanic()) throw std::runtime_error("the mapped format holds forests of the Titanic schema only");
+        const std::vector<DecisionTree>& trees = forest.getTrees();
+        ModelFileHeader fileHeader;
+        std::vector<ModelTreeEntry> treeEntries;
+        CategoryDictionary fileCategories[NumFeatures];
+        size_t fileSize = 0;
+        {
+            MappedForest existing(model_file);
+            if (existing.treeCount() != firstTree || firstTree > trees.size())
+                throw std::runtime_error(model_file + " holds " + std::to_string(existing.treeCount()) + " trees, not " + std::to_string(firstTree));
+            fileHeader = existing.header;
+            treeEntries.assign(existing.entries, existing.entries + firstTree);
+            for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) fileCategories[featureIdx] = existing.categories[featureIdx];
+            fileSize = existing.file.size();
+        }
+        //codes of the stored trees stay valid: new categories only extend the table
+        collectCategories(trees, firstTree, fileCategories);
+
+        std::fstream out(model_file, std::ios::in | std::ios::out | std::ios::binary);
+        if (!out.is_open()) throw std::runtime_error("cannot write " + model_file);
+        out.seekp(fileSize);
+        writeTrees(out, trees, firstTree, fileCategories, treeEntries);
+        writeIndex(out, treeEntries, fileCategories, fileHeader);
+        out.flush();
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+        if (!out) throw std::runtime_error("cannot write " + model_file);
+    }
+
+    //Map a model file written by save; throws std::runtime_error if it is not a valid model
+    explicit MappedForest(const std::string& model_file) : file(model_file) {
+        if (file.size() < sizeof(ModelFileHeader)) corrupt("too small");
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, ModelFileMagic, sizeof(ModelFileMagic)) != 0) corrupt("bad magic");
+        if (header.byteOrder != ModelFileByteOrder) corrupt("written with a different byte order");
+        if (header.version != ModelFileVersion) corrupt("unsupported version");
+        if (header.nodeSize != sizeof(TreeNode) || header.featureCount != NumFeatures) corrupt("incompatible node layout");
+        if (header.indexOffset % ModelFileAlignment != 0 || header.indexOffset > file.size()
+            || header.indexSize > file.size() - header.indexOffset
+            || header.treeCount > header.indexSize / sizeof(ModelTreeEntry)) corrupt("index out of range");
+
+        entries = reinterpret_cast<const ModelTreeEntry*>(file.data() + header.indexOffset);
+        size_t position = header.indexOffset + header.treeCount * sizeof(ModelTreeEntry);
+        for (CategoryDictionary& dictionary : categories) {
+            uint32_t count = readIndex<uint32_t>(position);
+            for (uint32_t code = 0; code < count; ++code) {
+                uint32_t length = readIndex<uint32_t>(position);
+                if (length > file.size() - position) corrupt("truncated category table");
+                dictionary.encode(std::string(file.data() + position, length));
+                position += length;
+            }
+        }
+
+        std::vector<uint32_t> levels;
+        for (uint32_t t = 0; t < header.treeCount; ++t) checkTree(entries[t], levels);
+    }
+
+    size_t treeCount() const {
+        return header.treeCount;
+    }
+
+    //Node array of a tree inside the mapping, root first
+    const TreeNode* treeNodes(size_t tree) const {
+        return reinterpret_cast<const TreeNode*>(file.data() + entries[tree].nodeOffset);
+    }
+
+    //Category sets of a tree inside the mapping, in the file's category codes
+    const uint64_t* treeCategorySets(size_t tree) const {
+        return reinterpret_cast<const uint64_t*>(file.data() + entries[tree].setOffset);
+    }
+
+    //Majority vote, stopping once the remaining trees cannot change it (as RandomForest::predict)
+    bool predict(const Passenger& p) const {
+        double row[NumFeatures];
+        DecisionTree::encodeRow(p, categories[Sex], categories[Embarked], row);
+        int votes0 = 0, votes1 = 0;
+        int remaining = (int)header.treeCount;
+        for (uint32_t t = 0; t < header.treeCount; ++t) {
+            if (entries[t].nodeCount > 0 && DecisionTree::walk(treeNodes(t), treeCategorySets(t), row)) ++votes1;
+            else ++votes0;
+            --remaining;
+            if (votes1 > votes0 + remaining || votes0 >= votes1 + remaining) break;
+        }
+        return votes1 > votes0;
+    }
+
+    //Fraction of trees voting survived for every row, scored tree-major like RandomForest::predictBatch
+    std::vector<double> predictBatch(const Dataset& rows, int nThreads = 1) const {
+        constexpr int BatchBlockSize = 256;
+        size_t n = rows.size();
+        std::vector<int> votes(n, 0);
+        if (n == 0 || header.treeCount == 0) return std::vector<double>(n, 0.0);
+
+        std::vector<int> categoryCodes[NumFeatures];
+        for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+            if (!isCategoricalFeature(featureIdx)) continue;
+            const CategoryDictionary& dictionary = rows.dictionary(featureIdx);
+            for (int code = 0; code < dictionary.size(); ++code)
+                categoryCodes[featureIdx].push_back(categories[featureIdx].find(dictionary.decode(code)));
+        }
+
+        size_t nBlocks = (n + BatchBlockSize - 1) / BatchBlockSize;
+        ThreadPool pool(nThreads);
+        int nTasks = (int)std::min<size_t>(nBlocks, (size_t)pool.threadCount() * 4);
+        pool.parallelFor(nTasks, [&](int task) {
+            std::vector<double> block(NumFeatures * BatchBlockSize);
+            std::vector<int32_t> cursor(BatchBlockSize);
+            const double* columns[NumFeatures];
+            for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) columns[featureIdx] = block.data() + featureIdx * BatchBlockSize;
+            for (size_t b = nBlocks * task / nTasks; b < nBlocks * (task + 1) / nTasks; ++b) {
+                size_t begin = b * BatchBlockSize;
+                int count = (int)std::min<size_t>(BatchBlockSize, n - begin);
+                rows.encodeBlock(begin, count, BatchBlockSize, block.data());
+                for (int featureIdx = 0; featureIdx < NumFeatures; ++featureIdx) {
+                    if (!isCategoricalFeature(featureIdx)) continue;
+                    double* values = block.data() + featureIdx * BatchBlockSize;
+                    for (int r = 0; r < count; ++r) values[r] = categoryCodes[featureIdx][(int)values[r]];
+                }
+                for (uint32_t t = 0; t < header.treeCount; ++t) {
+                    if (entries[t].nodeCount == 0) continue;
+                    DecisionTree::walkBlock(treeNodes(t), treeCategorySets(t), columns, count, (int)entries[t].depth, cursor.data(), votes.data() + begin);
+                }
+            }
+        });
+
+        std::vector<double> probabilities(n);
+        for (size_t i = 0; i < n; ++i) probabilities[i] = (double)votes[i] / header.treeCount;
+        return probabilities;
+    }
+
+    double evaluate(const Dataset& testData, int nThreads = 1) const {
+        std::vector<double> probabilities = predictBatch(testData, nThreads);
+        int correct = 0;
+        for (size_t i = 0; i < probabilities.size(); ++i) {
+            if ((probabilities[i] > 0.5) == (testData.label()[i] == 1)) ++correct;
+        }
+        return static_cast<double>(correct) / testData.size();
+    }
+};
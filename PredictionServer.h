@@ -0,0 +1,358 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CsvLoader.h"
+#include "RandomForest.h"
+
+#ifdef _WIN32
+#error "PredictionServer needs POSIX sockets"
+#endif
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Scores passengers for local clients with a forest written by RandomForest::save.
+//Clients connect to a Unix domain socket ("unix:PATH") or a localhost TCP port ("tcp:PORT") and
+//send one request per line, "Pclass,Sex,Age,SibSp,Parch,Fare,Embarked" (see
+//CsvLoader::parseFeatures); every request is answered, in order, by one line
+//"<survived 0/1> <fraction of trees voting survived>" or "error <message>". Clients may send
+//many lines without waiting for the answers.
+//Requests of all connections are queued and scored together with RandomForest::predictBatch:
+//a micro-batch is run once it has maxBatch requests or its oldest request has waited maxDelay.
+//reload swaps in a new model atomically; batches already running finish on the old one.
+class PredictionServer {
+private:
+    static constexpr size_t MaxLineBytes = 64 << 10;
+
+    struct Request {
+        std::string line;
+        std::chrono::steady_clock::time_point arrival;
+        std::promise<std::string> reply;
+    };
+
+    size_t maxBatch;
+    std::chrono::microseconds maxDelay;
+    ThreadPool pool; //of predictBatch, used by the batcher only
+    std::string modelFile;
+
+    std::shared_ptr<const RandomForest> model;
+    std::mutex modelMutex;
+
+    std::deque<Request*> queue;
+    std::mutex queueMutex;
+    std::condition_variable queueReady;
+    bool stopping = false;
+    std::thread batcher;
+
+    int listenFd = -1;
+    int wakeFds[2] = { -1, -1 }; //pipe that stop writes to so the acceptor returns
+    std::string socketPath; //unix socket to remove on stop
+    std::thread acceptor;
+    std::set<int> connections;
+    int activeConnections = 0;
+    std::mutex connectionMutex;
+    std::condition_variable connectionsDone;
+
+    std::shared_ptr<const RandomForest> currentModel() {
+        std::lock_guard<std::mutex> lock(modelMutex);
+        return model;
+    }
+
+    void scoreBatch(std::vector<Request*>& batch) {
+        std::shared_ptr<const RandomForest> forest = currentModel();
+        Dataset rows;
+        rows.reserve(batch.size());
+        std::vector<int> rowOf(batch.size(), -1);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            try {
+                CsvLoader::parseFeatures(batch[i]->line, rows);
+                rowOf[i] = (int)rows.size() - 1;
+            }
+            catch (const std::exception& e) {
+                batch[i]->reply.set_value(std::string("error ") + e.what() + "\n");
+            }
+        }
+        std::vector<double> probabilities;
+        std::string failure;
+        try {
+            probabilities = forest->predictBatch(rows, pool);
+        }
+        catch (const std::exception& e) {
+            failure = std::string("error ") + e.what() + "\n";
+        }
+        char answer[32];
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (rowOf[i] < 0) continue;
+            if (!failure.empty()) {
+                batch[i]->reply.set_value(failure);
+                continue;
+            }
+            double probability = probabilities[rowOf[i]];
+            std::snprintf(answer, sizeof(answer), "%d %.6f\n", probability > 0.5 ? 1 : 0, probability);
+            batch[i]->reply.set_value(answer);
+        }
+    }
+
+    //Runs until stop, then answers whatever is still queued
+    void batchLoop() {
+        std::vector<Request*> batch;
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (true) {
+            queueReady.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) return;
+            auto deadline = queue.front()->arrival + maxDelay;
+            queueReady.wait_until(lock, deadline, [this] { return stopping || queue.size() >= maxBatch; });
+            size_t n = std::min(queue.size(), maxBatch);
+            batch.assign(queue.begin(), queue.begin() + n);
+            queue.erase(queue.begin(), queue.begin() + n);
+            lock.unlock();
+            scoreBatch(batch);
+            lock.lock();
+        }
+    }
+
+    void submit(std::deque<Request>& requests) {
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            if (!stopping) {
+                for (Request& request : requests) queue.push_back(&request);
+            }
+            else {
+                for (Request& request : requests) request.reply.set_value("error server stopping\n");
+            }
+        }
+        queueReady.notify_one();
+    }
+
+    static bool sendAll(int fd, const std::string& text) {
+#ifdef MSG_NOSIGNAL
+        const int flags = MSG_NOSIGNAL;
+#else
+        const int flags = 0;
+#endif
+        size_t sent = 0;
+        while (sent < text.size()) {
+            ssize_t n = send(fd, text.data() + sent, text.size() - sent, flags);
+            if (n <= 0) return false;
+            sent += (size_t)n;
+        }
+        return true;
+    }
+
+    void serveConnection(int fd) {
+        std::string buffer;
+        char received[4096];
+        while (true) {
+            ssize_t n = recv(fd, received, sizeof(received), 0);
+            if (n <= 0) break;
+            buffer.append(received, (size_t)n);
+
+            //every complete line is a request; lines that arrived together are submitted together
+            std::deque<Request> requests;
+            size_t start = 0, end;
+            auto now = std::chrono::steady_clock::now();
+            while ((end = buffer.find('\n', start)) != std::string::npos) {
+                if (end > start && !(end == start + 1 && buffer[start] == '\r')) {
+                    requests.emplace_back();
+                    requests.back().line = buffer.substr(start, end - start);
+                    requests.back().arrival = now;
+                }
+                start = end + 1;
+            }
+            buffer.erase(0, start);
+            bool tooLong = buffer.size() > MaxLineBytes;
+
+            if (!requests.empty()) {
+                std::vector<std::future<std::string>> replies;
+                for (Request& request : requests) replies.push_back(request.reply.get_future());
+                submit(requests);
+                std::string answers;
+                for (std::future<std::string>& reply : replies) answers += reply.get();
+                if (!sendAll(fd, answers)) break;
+            }
+            if (tooLong) {
+                sendAll(fd, "error request line too long\n");
+                break;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        connections.erase(fd);
+        close(fd);
+        if (--activeConnections == 0) connectionsDone.notify_all();
+    }
+
+    void acceptLoop() {
+        while (true) {
+            pollfd events[2] = { { listenFd, POLLIN, 0 }, { wakeFds[0], POLLIN, 0 } };
+            if (poll(events, 2, -1) < 0) {
+                if (errno == EINTR) continue;
+                return;
+            }
+            if (events[1].revents) return;
+            int fd = accept(listenFd, nullptr, nullptr);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) continue;
+                return;
+            }
+            if (socketPath.empty()) {
+                int noDelay = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+            }
+            std::lock_guard<std::mutex> lock(connectionMutex);
+            connections.insert(fd);
+            ++activeConnections;
+            std::thread(&PredictionServer::serveConnection, this, fd).detach();
+        }
+    }
+
+    [[noreturn]] void fail(const std::string& what) {
+        int error = errno;
+        if (listenFd >= 0) close(listenFd);
+        listenFd = -1;
+        throw std::runtime_error(what + ": " + std::strerror(error));
+    }
+
+public:
+    //maxBatch requests at most per predictBatch call, which runs on a pool of nThreads threads
+    //(<= 0: every hardware thread) kept while the server exists. Throws std::runtime_error if the
+    //model cannot be loaded.
+    PredictionServer(const std::string& modelFile, size_t maxBatch = 256, std::chrono::microseconds maxDelay = std::chrono::microseconds(1000),
+        int nThreads = 1) :
+        maxBatch(std::max<size_t>(1, maxBatch)), maxDelay(maxDelay), pool(nThreads), modelFile(modelFile), model(loadModel(modelFile)) {}
+
+    PredictionServer(const PredictionServer&) = delete;
+    PredictionServer& operator=(const PredictionServer&) = delete;
+
+    ~PredictionServer() {
+        stop();
+    }
+
+    //Throws std::runtime_error if the file cannot be opened, is truncated or corrupt (e.g. still
+    //being written), is not of the Titanic schema or holds no trees
+    static std::shared_ptr<const RandomForest> loadModel(const std::string& modelFile) {
+        auto forest = std::make_shared<RandomForest>();
+        forest->load(modelFile, FeatureSchema::titanic());
+        if (forest->getTrees().empty()) throw std::runtime_error("no trees in " + modelFile);
+        if (!forest->isWellFormed()) throw std::runtime_error("invalid model file " + modelFile);
+        return forest;
+    }
+
+    //Start serving on "unix:PATH" (an existing socket file at PATH is replaced) or "tcp:PORT"
+    //(127.0.0.1 only; port 0 picks a free port, see port). Throws std::runtime_error on failure.
+    void listen(const std::string& address) {
+        if (listenFd >= 0) throw std::runtime_error("already listening");
+        if (address.compare(0, 5, "unix:") == 0) {
+            std::string path = address.substr(5);
+            sockaddr_un local{};
+            if (path.empty() || path.size() >= sizeof(local.sun_path)) throw std::runtime_error("invalid socket path: " + path);
+            local.sun_family = AF_UNIX;
+            std::memcpy(local.sun_path, path.c_str(), path.size() + 1);
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listenFd < 0) fail("socket");
+            unlink(path.c_str());
+            if (bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) fail("cannot bind " + path);
+            socketPath = path;
+        }
+        else if (address.compare(0, 4, "tcp:") == 0) {
+            sockaddr_in local{};
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            local.sin_port = htons((uint16_t)std::stoi(address.substr(4)));
+            listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listenFd < 0) fail("socket");
+            int reuse = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) fail("cannot bind " + address);
+        }
+        else {
+            throw std::runtime_error("address must be unix:PATH or tcp:PORT: " + address);
+        }
+        if (::listen(listenFd, SOMAXCONN) != 0) fail("listen");
+        if (pipe(wakeFds) != 0) fail("pipe");
+
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = false;
+        }
+        batcher = std::thread(&PredictionServer::batchLoop, this);
+        acceptor = std::thread(&PredictionServer::acceptLoop, this);
+    }
+
+    //TCP port being listened on, -1 for a unix socket or before listen
+    int port() const {
+        sockaddr_in local{};
+        socklen_t length = sizeof(local);
+        if (listenFd < 0 || !socketPath.empty() || getsockname(listenFd, (sockaddr*)&local, &length) != 0) return -1;
+        return ntohs(local.sin_port);
+    }
+
+    //Load modelFile and swap it in for new batches. On failure the current model stays and
+    //std::runtime_error is thrown.
+    void reload(const std::string& file) {
+        std::shared_ptr<const RandomForest> forest = loadModel(file);
+        std::lock_guard<std::mutex> lock(modelMutex);
+        model = std::move(forest);
+        modelFile = file;
+    }
+
+    //Reload the file the current model came from, e.g. after it was replaced by a rename
+    void reload() {
+        std::string file;
+        {
+            std::lock_guard<std::mutex> lock(modelMutex);
+            file = modelFile;
+        }
+        reload(file);
+    }
+
+    size_t treeCount() {
+        return currentModel()->getTrees().size();
+    }
+
+    //Stop accepting, close the connections once their submitted requests are answered and
+    //stop the batcher. Safe to call more than once.
+    void stop() {
+        if (listenFd < 0) return;
+        char wake = 0;
+        while (write(wakeFds[1], &wake, 1) < 0 && errno == EINTR) {}
+        acceptor.join();
+        close(wakeFds[0]);
+        close(wakeFds[1]);
+        close(listenFd);
+        listenFd = -1;
+        if (!socketPath.empty()) unlink(socketPath.c_str());
+        socketPath.clear();
+
+        {
+            std::unique_lock<std::mutex> lock(connectionMutex);
+            for (int fd : connections) shutdown(fd, SHUT_RD);
+            connectionsDone.wait(lock, [this] { return activeConnections == 0; });
+        }
+        {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            stopping = true;
+        }
+        queueReady.notify_one();
+        batcher.join();
+    }
+};
@@ -0,0 +1,111 @@
+// Checks of PredictionServer::reload on model files that are cut short, as when SIGHUP arrives while
+// the file is still being written:
+//   PredictionServerTest [titanic.csv]
+// Every truncated copy of a saved forest must be refused with std::runtime_error, keeping the current
+// model, which must go on answering requests. Requests with an Age or Fare that is not a number must be
+// answered with an error, and empty ones scored as missing. Prints the failures and returns 1 if there
+// are any.
+#include "PredictionServer.h"
+#include <csignal>
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string& path, const std::string& bytes) {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+}
+
+//Answer of the server on 127.0.0.1:port to one request line
+static std::string ask(int port, const std::string& line) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in remote{};
+    remote.sin_family = AF_INET;
+    remote.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    remote.sin_port = htons((uint16_t)port);
+    std::string answer;
+    if (fd >= 0 && connect(fd, (sockaddr*)&remote, sizeof(remote)) == 0) {
+        std::string request = line + "\n";
+        send(fd, request.data(), request.size(), 0);
+        char received[256];
+        ssize_t n;
+        while (answer.find('\n') == std::string::npos && (n = recv(fd, received, sizeof(received), 0)) > 0) answer.append(received, (size_t)n);
+    }
+    if (fd >= 0) close(fd);
+    return answer;
+}
+
+int main(int argc, char* argv[]) {
+    std::string dataFile = argc > 1 ? argv[1] : "titanic.csv";
+    std::string modelFile = "prediction_server_test.bin", cutFile = "prediction_server_test_cut.bin";
+    std::signal(SIGPIPE, SIG_IGN);
+    int failures = 0;
+    try {
+        std::ifstream in(dataFile);
+        if (!in.is_open()) throw std::runtime_error("cannot open " + dataFile);
+        RandomForest forest(20, 6, 2, 2, 0.7, 0, 1, 42);
+        forest.train(Dataset(CsvLoader::loadPassengers(in)));
+        forest.save(modelFile);
+        std::string bytes = readFile(modelFile);
+
+        PredictionServer server(modelFile);
+        server.listen("tcp:0");
+        std::string request = "3,male,22,1,0,7,S";
+        std::string expected = ask(server.port(), request);
+        if (expected.empty() || expected.compare(0, 5, "error") == 0) {
+            std::cerr << "no answer from the server: " << expected << "\n";
+            ++failures;
+        }
+        for (const char* invalid : { "3,male,abc,1,0,7,S", "3,male,22,1,0,abc,S" }) {
+            std::string answer = ask(server.port(), invalid);
+            if (answer.compare(0, 6, "error ") != 0) {
+                std::cerr << "request " << invalid << " answered " << answer << "\n";
+                ++failures;
+            }
+        }
+        std::string missing = ask(server.port(), "3,male,,1,0,,S");
+        if (missing.empty() || missing.compare(0, 5, "error") == 0) {
+            std::cerr << "request with missing Age and Fare answered " << missing << "\n";
+            ++failures;
+        }
+
+        for (size_t size = 0; size < bytes.size(); ++size) {
+            writeFile(cutFile, bytes.substr(0, size));
+            try {
+                server.reload(cutFile);
+                std::cerr << "reload accepted a file cut to " << size << " of " << bytes.size() << " bytes\n";
+                ++failures;
+                server.reload(modelFile);
+            }
+            catch (const std::runtime_error&) {
+            }
+            if (server.treeCount() != forest.getTrees().size()) {
+                std::cerr << "model changed by a failed reload of " << size << " bytes\n";
+                ++failures;
+            }
+        }
+        std::string answer = ask(server.port(), request);
+        if (answer != expected) {
+            std::cerr << "answer after failed reloads: " << answer << ", expected " << expected;
+            ++failures;
+        }
+
+        writeFile(cutFile, bytes);
+        server.reload(cutFile);
+        if (ask(server.port(), request) != expected) {
+            std::cerr << "complete file not reloaded\n";
+            ++failures;
+        }
+        server.stop();
+        std::cout << bytes.size() << " truncated model files refused, " << failures << " failures" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        ++failures;
+    }
+    std::remove(modelFile.c_str());
+    std::remove(cutFile.c_str());
+    return failures == 0 ? 0 : 1;
+}
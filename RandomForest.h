@@ -1,6 +1,13 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <stdexcept>
+
 #include "DecisionTree.h"
+#include "ThreadPool.h"
+#include "TrainingMessage.h"
 
 class RandomForest {
 private:
@@ -10,50 +17,722 @@ private:
 	int minSamplesSplit;
 	int minSamplesLeaf;
 	double featureSampleRatio;
+	int maxBins;
+	int nThreads;
+	unsigned seed;
+	bool extraTrees; //grow extremely randomized trees (see DecisionTree)
+	double oobAccuracy = -1; //out-of-bag accuracy of the last train, -1 if not computed
+	TrainingTelemetry* telemetry = nullptr;
+	std::shared_ptr<const FeatureSchema> featureSchema = FeatureSchema::titanic(); //of the trees
+
+	//create bootstrap sample of rows (all size rows if null): the number of times each row is drawn
+	std::vector<unsigned> createBootstrapSample(unsigned size, const std::vector<int>* rows, std::mt19937& rng) {
+		std::vector<unsigned> counts(size, 0);
+		int n = rows ? (int)rows->size() : (int)size;
+		if (n == 0) return counts;
+		std::uniform_int_distribution<int> dist(0, n - 1);
+		for (int i = 0; i < n; ++i) {
+			int drawn = dist(rng);
+			++counts[rows ? (*rows)[drawn] : drawn];
+		}
+		return counts;
+	}
+
+	//Untrained tree with the forest's hyperparameters
+	DecisionTree makeTree() const {
+		return DecisionTree(maxDepth, minSamplesSplit, minSamplesLeaf, featureSampleRatio, maxBins, 1, extraTrees);
+	}
+
+	//Every tree draws from its own stream derived from (seed, tree index), so the forest
+	//does not depend on how trees are scheduled over threads
+	std::mt19937 treeRng(int treeIdx) const {
+		std::seed_seq seq{ seed, (unsigned)treeIdx };
+		return std::mt19937(seq);
+	}
+
+	//Times a row is drawn into a tree's bootstrap sample when the data is streamed: Poisson(1),
+	//the limit of drawing n of n rows, computed from a hash of (tree key, row) so every pass over
+	//the data sees the same sample without storing it
+	static int bootstrapWeight(uint64_t treeKey, uint64_t row) {
+		uint64_t z = hashMix(treeKey + row * 0x9e3779b97f4a7c15ull);
+		double u = (z >> 11) * 0x1.0p-53;
+		double probability = std::exp(-1.0), cumulative = probability;
+		int k = 0;
+		while (u >= cumulative && k < 16) {
+			++k;
+			probability /= k;
+			cumulative += probability;
+		}
+		return k;
+	}
+
+	//Distinct values of a feature are counted exactly up to MaxDistinctValues; beyond that
+	//neighbouring values are merged pairwise, which keeps the equal-frequency edges approximate
+	static constexpr size_t MaxDistinctValues = 1 << 16;
+
+	static void capDistinctValues(std::map<int, uint64_t>& counts) {
+		if (counts.size() <= MaxDistinctValues) return;
+		std::map<int, uint64_t> merged;
+		for (auto it = counts.begin(); it != counts.end(); ++it) {
+			uint64_t count = it->second;
+			if (std::next(it) != counts.end()) count += (++it)->second;
+			merged.emplace_hint(merged.end(), it->first, count);
+		}
+		counts = std::move(merged);
+	}
+
+	//Add the rows of chunk to the counts of every numerical feature's values
+	static void countValues(const Dataset& chunk, std::vector<std::map<int, uint64_t>>& valueCounts) {
+		const FeatureSchema& schema = *chunk.schema();
+		valueCounts.resize(schema.featureCount());
+		for (int featureIdx = 0; featureIdx < schema.featureCount(); ++featureIdx) {
+			if (schema.isCategorical(featureIdx)) continue;
+			std::map<int, uint64_t>& counts = valueCounts[featureIdx];
+			int missingBelow = schema.feature(featureIdx).missingBelow;
+			for (int value : chunk.column(featureIdx)) {
+				if (value >= missingBelow) ++counts[value];
+			}
+			capDistinctValues(counts);
+		}
+	}
+
+	//Histogram bins (as in histogram mode, maxBins or 255 when 0) from the value counts of the
+	//numerical features and the dictionaries of categories
+	HistogramLayout binLayout(const Dataset& categories, std::vector<std::map<int, uint64_t>>& valueCounts) const {
+		HistogramLayout layout(categories.schema());
+		int nBins = maxBins > 0 ? std::min(maxBins, 255) : 255;
+		valueCounts.resize(categories.featureCount());
+		for (int featureIdx = 0; featureIdx < categories.featureCount(); ++featureIdx) {
+			if (categories.schema()->isCategorical(featureIdx)) {
+				layout.setBins(featureIdx, {}, categories.dictionary(featureIdx).size());
+				continue;
+			}
+			std::vector<std::pair<int, uint64_t>> counts(valueCounts[featureIdx].begin(), valueCounts[featureIdx].end());
+			layout.setBins(featureIdx, HistogramLayout::quantileEdges(counts, std::max(nBins, 2)), 0);
+		}
+		return layout;
+	}
+
+	//Histogram bins of a streaming run from one pass over the data
+	template <typename ChunkSource>
+	HistogramLayout streamingBins(ChunkSource& source, Dataset& chunk, uint64_t& rows) {
+		std::vector<std::map<int, uint64_t>> valueCounts;
+		rows = 0;
+		source.rewind();
+		while (source.next(chunk)) {
+			rows += chunk.size();
+			countValues(chunk, valueCounts);
+		}
+		return binLayout(chunk, valueCounts);
+	}
+
+	//Node histograms of one level-wise data pass: tree t owns histograms [first[t], first[t] + count[t])
+	//of the batch, for its pending nodes from begin[t]
+	struct HistogramBatch {
+		std::vector<uint64_t> first;
+		std::vector<int> begin, count;
+		uint64_t size = 0;
+	};
+
+	//Next batch of at most maxPending pending nodes of the growing trees, continuing from pending
+	//node nodePos of tree growing[treePos]
+	HistogramBatch nextBatch(const std::vector<int>& growing, size_t& treePos, int& nodePos, size_t maxPending) const {
+		HistogramBatch batch;
+		batch.first.assign(nTrees, 0);
+		batch.begin.assign(nTrees, 0);
+		batch.count.assign(nTrees, 0);
+		while (treePos < growing.size() && batch.size < maxPending) {
+			int t = growing[treePos];
+			int n = (int)std::min<size_t>(trees[t].pendingCount() - nodePos, maxPending - batch.size);
+			batch.first[t] = batch.size;
+			batch.begin[t] = nodePos;
+			batch.count[t] = n;
+			batch.size += n;
+			nodePos += n;
+			if (nodePos == trees[t].pendingCount()) {
+				++treePos;
+				nodePos = 0;
+			}
+		}
+		return batch;
+	}
+
+	//Add the bootstrap-weighted rows of chunk, rows rowBase on of the data, to tree t's histograms
+	//of the batch; the rows are counted in blocks of at most BlockRows
+	static void addTreeHistograms(const std::vector<DecisionTree>& trees, int t, uint64_t treeKey, const Dataset& chunk, uint64_t rowBase,
+		const HistogramBatch& batch, const HistogramLayout& layout, unsigned* histograms) {
+		constexpr size_t BlockRows = 1 << 16;
+		const std::vector<uint8_t>& labels = chunk.label();
+		size_t histogramSize = layout.size();
+		std::vector<int> slots, weights;
+		for (size_t start = 0; start < chunk.size(); start += BlockRows) {
+			size_t rows = std::min(BlockRows, chunk.size() - start);
+			//histogram of every row of the block in this batch (-1: none), then the counts feature by feature
+			slots.assign(rows, -1);
+			weights.assign(rows, 0);
+			for (size_t r = 0; r < rows; ++r) {
+				int weight = bootstrapWeight(treeKey, rowBase + start + r);
+				if (weight == 0) continue;
+				int pending = trees[t].pendingIndex(chunk, start + r) - batch.begin[t];
+				if (pending < 0 || pending >= batch.count[t]) continue;
+				slots[r] = (int)batch.first[t] + pending;
+				weights[r] = weight;
+				histograms[slots[r] * histogramSize + layout.offset.back() + labels[start + r]] += weight;
+			}
+			for (int featureIdx = 0; featureIdx < chunk.featureCount(); ++featureIdx) {
+				layout.addFeatureCounts(featureIdx, chunk.column(featureIdx).data() + start, labels.data() + start, slots.data(), weights.data(),
+					rows, histograms);
+			}
+		}
+	}
 
-	//create bootstrap sample
-	std::vector<int> createBootstrapSample(unsigned size, std::mt19937& rng) {
-		std::vector<int> sample(size);
-		std::uniform_int_distribution<int> dist(0, size - 1);
-		for (int i = 0; i < size; ++i) {
-			sample[i] = dist(rng);
+	//Split every pending node of the batch on its histogram
+	void choosePendingSplits(const HistogramBatch& batch, const HistogramLayout& layout, const std::vector<unsigned>& histograms) {
+		for (int t = 0; t < nTrees; ++t) {
+			for (int i = 0; i < batch.count[t]; ++i)
+				trees[t].choosePendingSplit(batch.begin[t] + i, layout, histograms.data() + (batch.first[t] + i) * layout.size());
 		}
-		return sample;
+	}
+
+	//Commands of the coordinator of trainDistributed to its workers
+	enum class TrainingCommand : int32_t { Setup, Histograms, Splits, Done };
+
+	//A pending split in a Splits message: its plain fields, then its category set
+	static void putSplit(TrainingMessage& message, const DecisionTree::PendingSplit& split) {
+		message.put(split.count0).put(split.count1).put(split.left0).put(split.left1).put(split.featureIdx).put(split.splitValue)
+			.putVector(split.categories);
+	}
+
+	static DecisionTree::PendingSplit getSplit(TrainingMessage& message) {
+		DecisionTree::PendingSplit split;
+		split.count0 = message.get<unsigned>();
+		split.count1 = message.get<unsigned>();
+		split.left0 = message.get<unsigned>();
+		split.left1 = message.get<unsigned>();
+		split.featureIdx = message.get<int>();
+		split.splitValue = message.get<double>();
+		split.categories = message.getVector<uint64_t>();
+		return split;
+	}
+
+	std::vector<std::vector<int>> presort(const Dataset& data) {
+		TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Presort);
+		return DecisionTree::presortFeatures(data);
+	}
+
+	void addTrees(const Dataset& data, const std::vector<int>* rows, const std::vector<std::vector<int>>& sorted, int count) {
+		if (!trees.empty() && *data.schema() != *featureSchema) throw std::runtime_error("added trees must have the forest's feature schema");
+		int first = (int)trees.size();
+		trees.resize(first + std::max(count, 0), makeTree());
+		nTrees = (int)trees.size();
+		trainTrees(data, sorted, rows, first);
+	}
+
+	//Train trees [first, end) in parallel on rows of data (all rows if null), whose presort is sorted,
+	//and set oobAccuracy from those trees and rows
+	void trainTrees(const Dataset& data, const std::vector<std::vector<int>>& sorted, const std::vector<int>* rows, int first) {
+		featureSchema = data.schema();
+		std::vector<std::atomic<int>> oobVotes(data.size()), oobTrees(data.size());
+		ThreadPool pool(nThreads);
+		pool.parallelFor((int)trees.size() - first, [&](int k) {
+			int i = first + k;
+			std::mt19937 rng = treeRng(i);
+			std::vector<unsigned> counts;
+			std::vector<int> outOfBag;
+			{
+				TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Bootstrap);
+				//create bootstrap sample
+				counts = createBootstrapSample(data.size(), rows, rng);
+				int n = rows ? (int)rows->size() : (int)data.size();
+				for (int r = 0; r < n; ++r) {
+					int idx = rows ? (*rows)[r] : r;
+					if (counts[idx] == 0) outOfBag.push_back(idx);
+				}
+			}
+
+			auto start = std::chrono::steady_clock::now();
+			trees[i].setTelemetry(telemetry);
+			trees[i].train(data, std::move(counts), sorted, rng());
+			trees[i].setTelemetry(nullptr);
+			if (telemetry) {
+				double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				telemetry->recordTree(i, seconds, trees[i].getNodes().size(), trees[i].depth());
+			}
+
+			TrainingTelemetry::PhaseTimer oobTimer(telemetry, TrainingPhase::OutOfBag);
+			for (int idx : outOfBag) {
+				oobTrees[idx].fetch_add(1, std::memory_order_relaxed);
+				if (trees[i].predict(data, idx)) oobVotes[idx].fetch_add(1, std::memory_order_relaxed);
+			}
+		});
+
+		//majority vote of the trees that did not see each row
+		int scored = 0, correct = 0;
+		for (size_t idx = 0; idx < data.size(); ++idx) {
+			int votes1 = oobVotes[idx].load(), votes = oobTrees[idx].load();
+			if (votes == 0) continue;
+			++scored;
+			if ((votes1 > votes - votes1) == (data.label()[idx] == 1)) ++correct;
+		}
+		oobAccuracy = scored > 0 ? (double)correct / scored : -1;
 	}
 
 public:
-	RandomForest(int nTrees = 100, int maxDepth = 5, int minSamplesSplit = 2, int minSamplesLeaf = 1, double featureSampleRatio = 1.0) :
-		nTrees(nTrees), maxDepth(maxDepth), minSamplesSplit(minSamplesSplit), minSamplesLeaf(minSamplesLeaf), featureSampleRatio(featureSampleRatio) {}
+	//maxBins > 0 trains every tree in histogram mode (see DecisionTree).
+	//nThreads <= 0 trains on every hardware thread; a given seed gives the same forest at any thread count.
+	//extraTrees grows extremely randomized trees, each on its bootstrap sample as usual: one random
+	//split per sampled feature instead of the best, which trains faster on large, noisy data.
+	RandomForest(int nTrees = 100, int maxDepth = 5, int minSamplesSplit = 2, int minSamplesLeaf = 1, double featureSampleRatio = 1.0,
+		int maxBins = 0, int nThreads = 1, unsigned seed = std::random_device{}(), bool extraTrees = false) :
+		nTrees(nTrees), maxDepth(maxDepth), minSamplesSplit(minSamplesSplit), minSamplesLeaf(minSamplesLeaf), featureSampleRatio(featureSampleRatio),
+		maxBins(maxBins), nThreads(nThreads), seed(seed), extraTrees(extraTrees) {}
 
 	
 	void train(const std::vector<Passenger>& data) {
-		std::random_device rd;
-		std::mt19937 rng(rd());
-		trees.reserve(nTrees);
+		train(Dataset(data));
+	}
+
+	//Every tree trains on the shared data with its bootstrap sample as row weights, so no rows are copied.
+	//Rows left out of a tree's sample are scored by that tree as it finishes, which gives the
+	//out-of-bag accuracy (see outOfBagAccuracy).
+	void train(const Dataset& data) {
+		trees.assign(nTrees, makeTree());
+		trainTrees(data, presort(data), nullptr, 0);
+	}
+
+	//Warm start: train count more trees on data and add them behind the current ones (e.g. of a
+	//loaded forest), with this forest's hyperparameters. Tree i draws from the same stream as in
+	//train, so with the same seed and data, n trees grown by m equal a forest of n + m trained at once.
+	//outOfBagAccuracy then covers the new trees only.
+	//Throws std::runtime_error if data has other features than the current trees.
+	void addTrees(const Dataset& data, int count) {
+		addTrees(data, nullptr, presort(data), count);
+	}
+
+	//addTrees on the given rows of data only (e.g. the training folds of a cross-validation): the
+	//bootstrap samples are drawn from rows and outOfBagAccuracy is over rows. sorted is
+	//DecisionTree::presortFeatures(data), so one presort serves every subset of the rows.
+	void addTrees(const Dataset& data, const std::vector<int>& rows, const std::vector<std::vector<int>>& sorted, int count) {
+		addTrees(data, &rows, sorted, count);
+	}
+
+	void addTrees(const std::vector<Passenger>& data, int count) {
+		addTrees(Dataset(data), count);
+	}
+
+	//Out-of-core training over data that is read in chunks and never held in memory as a whole.
+	//ChunkSource has rewind() and bool next(Dataset& chunk), which replaces chunk with the next rows;
+	//all chunks must share category dictionaries (CsvChunkReader does this).
+	//One pass finds the histogram bins (as in histogram mode, maxBins or 255 when 0); then all trees
+	//grow one level per pass, each pending node splitting on the class counts of its rows per bin.
+	//Bootstrap samples are Poisson row weights instead of drawn indices. Node histograms are capped
+	//at histogramBytes: when a level needs more, it takes several passes, so peak memory is one
+	//chunk plus histogramBytes plus the trees.
+	template <typename ChunkSource>
+	void trainStreaming(ChunkSource& source, size_t histogramBytes = 256 << 20) {
+		oobAccuracy = -1;
+		trees.assign(nTrees, makeTree());
+		Dataset chunk;
+		uint64_t rows = 0;
+		HistogramLayout layout;
+		{
+			TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Binning);
+			layout = streamingBins(source, chunk, rows);
+		}
+		featureSchema = chunk.schema();
+		if (rows == 0) return;
+
+		std::vector<uint64_t> treeKeys(nTrees);
+		for (int i = 0; i < nTrees; ++i) {
+			std::mt19937 rng = treeRng(i);
+			treeKeys[i] = ((uint64_t)rng() << 32) | rng();
+			trees[i].setTelemetry(telemetry);
+			trees[i].beginLevelwise(chunk, rng());
+		}
+
+		size_t histogramSize = layout.size();
+		size_t maxPending = std::max<size_t>(1, histogramBytes / (histogramSize * sizeof(unsigned)));
+		ThreadPool pool(nThreads);
+		std::vector<int> growing(nTrees);
+		std::iota(growing.begin(), growing.end(), 0);
+		while (!growing.empty()) {
+			//pending nodes of this level, a batch of at most maxPending per pass
+			size_t treePos = 0;
+			int nodePos = 0;
+			while (treePos < growing.size()) {
+				HistogramBatch batch = nextBatch(growing, treePos, nodePos, maxPending);
+				TrainingTelemetry::PhaseTimer passTimer(telemetry, TrainingPhase::DataPass);
+				std::vector<unsigned> histograms(batch.size * histogramSize, 0);
+				uint64_t rowBase = 0;
+				source.rewind();
+				while (source.next(chunk)) {
+					pool.parallelFor(nTrees, [&](int t) {
+						if (batch.count[t] == 0) return;
+						addTreeHistograms(trees, t, treeKeys[t], chunk, rowBase, batch, layout, histograms.data());
+						if (telemetry) telemetry->countHistogramRows(chunk.size());
+					});
+					rowBase += chunk.size();
+				}
+				choosePendingSplits(batch, layout, histograms);
+			}
+
+			std::vector<int> stillGrowing;
+			for (int t : growing) {
+				if (trees[t].nextLevel()) stillGrowing.push_back(t);
+			}
+			growing = std::move(stillGrowing);
+		}
+		for (DecisionTree& tree : trees) tree.setTelemetry(nullptr);
+	}
+
+	//Data-parallel training over shards of the rows, each held by a worker that runs trainShard
+	//(typically another process), with this forest as the coordinator. Channel is the transport to
+	//one worker: send(const std::string&) and std::string receive() carry whole messages in order and
+	//throw std::runtime_error on failure (see FdChannel for pipes and sockets).
+	//The trees grow one level per round as in trainStreaming: every worker adds its rows to the
+	//histograms of the pending nodes, the coordinator sums the histograms of all workers, chooses the
+	//splits and sends them back. The forest is that of trainStreaming over the shards concatenated
+	//in worker order, as long as no feature has more than MaxDistinctValues distinct values.
+	//Throws std::runtime_error if the shards have different feature schemas or a channel fails.
+	template <typename Channel>
+	void trainDistributed(std::vector<Channel>& workers, size_t histogramBytes = 256 << 20) {
+		if (workers.empty()) throw std::invalid_argument("distributed training needs workers");
+		oobAccuracy = -1;
+		trees.assign(nTrees, makeTree());
+
+		//bins from the shard summaries: schema, rows, category dictionaries and value counts
+		std::vector<uint64_t> rowBase(workers.size() + 1, 0);
+		Dataset categories;
+		std::vector<std::map<int, uint64_t>> valueCounts;
+		HistogramLayout layout;
+		{
+			TrainingTelemetry::PhaseTimer timer(telemetry, TrainingPhase::Binning);
+			for (size_t w = 0; w < workers.size(); ++w) {
+				TrainingMessage summary(workers[w].receive());
+				std::vector<FeatureSpec> features(summary.get<int32_t>());
+				for (FeatureSpec& feature : features) {
+					feature.name = summary.getString();
+					feature.kind = summary.get<FeatureKind>();
+					feature.missingBelow = summary.get<int32_t>();
+					feature.decimals = summary.get<int32_t>();
+				}
+				auto schema = std::make_shared<const FeatureSchema>(std::move(features));
+				if (w == 0) categories = Dataset(schema);
+				else if (*schema != *categories.schema()) throw std::runtime_error("worker shards have different feature schemas");
+				rowBase[w + 1] = rowBase[w] + summary.get<uint64_t>();
+				valueCounts.resize(schema->featureCount());
+				for (int featureIdx = 0; featureIdx < schema->featureCount(); ++featureIdx) {
+					if (schema->isCategorical(featureIdx)) {
+						for (uint64_t n = summary.get<uint64_t>(); n > 0; --n) categories.encodeCategory(featureIdx, summary.getString());
+						continue;
+					}
+					std::vector<int32_t> values = summary.getVector<int32_t>();
+					std::vector<uint64_t> counts = summary.getVector<uint64_t>();
+					if (counts.size() != values.size()) throw std::runtime_error("invalid shard summary");
+					for (size_t i = 0; i < values.size(); ++i) valueCounts[featureIdx][values[i]] += counts[i];
+					capDistinctValues(valueCounts[featureIdx]);
+				}
+			}
+			layout = binLayout(categories, valueCounts);
+		}
+		featureSchema = categories.schema();
+		auto broadcast = [&](const TrainingMessage& message) {
+			for (Channel& worker : workers) worker.send(message.data());
+		};
+		if (rowBase.back() == 0) {
+			broadcast(TrainingMessage().put(TrainingCommand::Done));
+			return;
+		}
+
+		std::vector<uint64_t> treeKeys(nTrees);
 		for (int i = 0; i < nTrees; ++i) {
-			//create bootstrap sample
-			auto sampleIndices = createBootstrapSample(data.size(), rng);
-			//create and train tree
-			DecisionTree tree(maxDepth, minSamplesSplit, minSamplesLeaf, featureSampleRatio);
+			std::mt19937 rng = treeRng(i);
+			treeKeys[i] = ((uint64_t)rng() << 32) | rng();
+			trees[i].setTelemetry(telemetry);
+			trees[i].beginLevelwise(categories, rng());
+		}
+		for (size_t w = 0; w < workers.size(); ++w) {
+			TrainingMessage setup;
+			setup.put(TrainingCommand::Setup).put<int32_t>(maxDepth).put<int32_t>(minSamplesSplit).put<int32_t>(minSamplesLeaf)
+				.put<uint64_t>(rowBase[w]).putVector(treeKeys);
+			for (int featureIdx = 0; featureIdx < featureSchema->featureCount(); ++featureIdx) {
+				if (!featureSchema->isCategorical(featureIdx)) {
+					setup.putVector(layout.edges[featureIdx]);
+					continue;
+				}
+				const CategoryDictionary& dictionary = categories.dictionary(featureIdx);
+				setup.put<uint64_t>(dictionary.size());
+				for (int code = 0; code < dictionary.size(); ++code) setup.putString(dictionary.decode(code));
+			}
+			workers[w].send(setup.data());
+		}
+
+		size_t histogramSize = layout.size();
+		size_t maxPending = std::max<size_t>(1, histogramBytes / (histogramSize * sizeof(unsigned)));
+		std::vector<int> growing(nTrees);
+		std::iota(growing.begin(), growing.end(), 0);
+		while (!growing.empty()) {
+			size_t treePos = 0;
+			int nodePos = 0;
+			while (treePos < growing.size()) {
+				HistogramBatch batch = nextBatch(growing, treePos, nodePos, maxPending);
+				TrainingTelemetry::PhaseTimer passTimer(telemetry, TrainingPhase::DataPass);
+				broadcast(TrainingMessage().put(TrainingCommand::Histograms).put(batch.size)
+					.putVector(batch.first).putVector(batch.begin).putVector(batch.count));
+				std::vector<unsigned> histograms(batch.size * histogramSize, 0);
+				for (Channel& worker : workers) {
+					std::vector<unsigned> counts = TrainingMessage(worker.receive()).getVector<unsigned>();
+					if (counts.size() != histograms.size()) throw std::runtime_error("worker histograms do not match the batch");
+					for (size_t i = 0; i < counts.size(); ++i) histograms[i] += counts[i];
+				}
+				choosePendingSplits(batch, layout, histograms);
+			}
+
+			TrainingMessage splits;
+			splits.put(TrainingCommand::Splits);
+			std::vector<int> stillGrowing;
+			for (int t : growing) {
+				for (int i = 0; i < trees[t].pendingCount(); ++i) putSplit(splits, trees[t].pendingSplit(i));
+				if (trees[t].nextLevel()) stillGrowing.push_back(t);
+			}
+			broadcast(splits);
+			growing = std::move(stillGrowing);
+		}
+		broadcast(TrainingMessage().put(TrainingCommand::Done));
+		for (DecisionTree& tree : trees) tree.setTelemetry(nullptr);
+	}
 
-			//create sampled dataset
-			std::vector<Passenger> sampleData;
-			for (int idx : sampleIndices)
-				sampleData.push_back(data[idx]);
+	//Worker side of trainDistributed: serve the coordinator at the other end of the channel with a
+	//shard of the training rows until it has trained its forest. Category codes are translated to the
+	//coordinator's, which takes a copy of the shard. nThreads <= 0 counts on every hardware thread.
+	//Throws std::runtime_error if the channel fails or a message is invalid.
+	template <typename Channel>
+	static void trainShard(const Dataset& shard, Channel& coordinator, int nThreads = 1) {
+		const FeatureSchema& schema = *shard.schema();
+		std::vector<std::map<int, uint64_t>> valueCounts;
+		countValues(shard, valueCounts);
+		TrainingMessage summary;
+		summary.put<int32_t>(schema.featureCount());
+		for (int featureIdx = 0; featureIdx < schema.featureCount(); ++featureIdx) {
+			const FeatureSpec& feature = schema.feature(featureIdx);
+			summary.putString(feature.name).put(feature.kind).put<int32_t>(feature.missingBelow).put<int32_t>(feature.decimals);
+		}
+		summary.put<uint64_t>(shard.size());
+		for (int featureIdx = 0; featureIdx < schema.featureCount(); ++featureIdx) {
+			if (schema.isCategorical(featureIdx)) {
+				const CategoryDictionary& dictionary = shard.dictionary(featureIdx);
+				summary.put<uint64_t>(dictionary.size());
+				for (int code = 0; code < dictionary.size(); ++code) summary.putString(dictionary.decode(code));
+				continue;
+			}
+			std::vector<int32_t> values;
+			std::vector<uint64_t> counts;
+			for (const auto& [value, count] : valueCounts[featureIdx]) {
+				values.push_back(value);
+				counts.push_back(count);
+			}
+			summary.putVector(values).putVector(counts);
+		}
+		coordinator.send(summary.data());
 
-			tree.train(sampleData);
-			trees.push_back(tree);
+		Dataset data(shard.schema());
+		HistogramLayout layout(shard.schema());
+		std::vector<DecisionTree> trees;
+		std::vector<uint64_t> treeKeys;
+		std::vector<int> growing;
+		uint64_t rowBase = 0;
+		ThreadPool pool(nThreads);
+		while (true) {
+			TrainingMessage message(coordinator.receive());
+			TrainingCommand command = message.get<TrainingCommand>();
+			if (command == TrainingCommand::Done) return;
+			if (command == TrainingCommand::Setup) {
+				int depth = message.get<int32_t>(), samplesSplit = message.get<int32_t>(), samplesLeaf = message.get<int32_t>();
+				rowBase = message.get<uint64_t>();
+				treeKeys = message.getVector<uint64_t>();
+				for (int featureIdx = 0; featureIdx < schema.featureCount(); ++featureIdx) {
+					if (!schema.isCategorical(featureIdx)) {
+						layout.setBins(featureIdx, message.getVector<double>(), 0);
+						continue;
+					}
+					uint64_t n = message.get<uint64_t>();
+					for (uint64_t code = 0; code < n; ++code) data.encodeCategory(featureIdx, message.getString());
+					layout.setBins(featureIdx, {}, (int)n);
+				}
+				data.append(shard);
+				trees.assign(treeKeys.size(), DecisionTree(depth, samplesSplit, samplesLeaf));
+				for (DecisionTree& tree : trees) tree.beginLevelwise(data, 0);
+				growing.resize(trees.size());
+				std::iota(growing.begin(), growing.end(), 0);
+			}
+			else if (command == TrainingCommand::Histograms) {
+				HistogramBatch batch;
+				batch.size = message.get<uint64_t>();
+				batch.first = message.getVector<uint64_t>();
+				batch.begin = message.getVector<int>();
+				batch.count = message.getVector<int>();
+				if (batch.first.size() != trees.size() || batch.begin.size() != trees.size() || batch.count.size() != trees.size())
+					throw std::runtime_error("invalid histogram request");
+				std::vector<unsigned> histograms(batch.size * layout.size(), 0);
+				pool.parallelFor((int)trees.size(), [&](int t) {
+					if (batch.count[t] > 0) addTreeHistograms(trees, t, treeKeys[t], data, rowBase, batch, layout, histograms.data());
+				});
+				coordinator.send(TrainingMessage().putVector(histograms).data());
+			}
+			else if (command == TrainingCommand::Splits) {
+				std::vector<int> stillGrowing;
+				for (int t : growing) {
+					for (int i = 0; i < trees[t].pendingCount(); ++i) trees[t].setPendingSplit(i, getSplit(message));
+					if (trees[t].nextLevel()) stillGrowing.push_back(t);
+				}
+				growing = std::move(stillGrowing);
+			}
+			else {
+				throw std::runtime_error("unknown training command");
+			}
 		}
 	}
 
+	//Record phase times, counters and per-tree build times of the following train calls in
+	//telemetry (nullptr: stop recording). The telemetry must outlive those calls.
+	void setTelemetry(TrainingTelemetry* training) {
+		telemetry = training;
+	}
+
+	//Majority vote of the trees, in their order; stops as soon as the trees not yet run cannot change it
 	bool predict(const Passenger& p) const {
+		return predict(p, 1.0);
+	}
+
+	//Like predict(p), but also stops once the votes so far settle the majority with the given
+	//confidence (0.99: stop when a tree vote rate this far from 1/2 arises by chance less than 1% of
+	//the time, by Hoeffding's bound), which may differ from the full vote; 1.0 gives the exact vote.
+	//treesRun, if given, receives the number of trees evaluated.
+	bool predict(const Passenger& p, double confidence, int* treesRun = nullptr) const {
+		double bound = confidence < 1.0 ? std::log(1.0 / (1.0 - confidence)) / 2.0 : -1.0;
 		int votes0 = 0, votes1 = 0;
+		int remaining = (int)trees.size();
 		for (const DecisionTree& tree : trees) {
-			int pred = tree.predict(p);
-			if (pred == 0) votes0++;
-			else votes1++;
+			if (tree.predict(p)) votes1++;
+			else votes0++;
+			--remaining;
+			if (votes1 > votes0 + remaining || votes0 >= votes1 + remaining) break;
+			int n = votes0 + votes1;
+			double margin = votes1 - n / 2.0;
+			if (bound >= 0 && margin * margin > bound * n) break;
+		}
+		if (treesRun) *treesRun = votes0 + votes1;
+		return votes1 > votes0;
+	}
+
+	//Reorder the trees so that early-exit prediction decides sooner: trees that agree most often
+	//with the full vote on rows run first. Votes are unchanged; save writes the trees in this order.
+	void orderTreesForEarlyExit(const std::vector<Passenger>& rows) {
+		std::vector<std::vector<char>> treeVotes(trees.size(), std::vector<char>(rows.size()));
+		std::vector<int> votes1(rows.size(), 0);
+		for (size_t t = 0; t < trees.size(); ++t) {
+			for (size_t r = 0; r < rows.size(); ++r) {
+				treeVotes[t][r] = trees[t].predict(rows[r]);
+				votes1[r] += treeVotes[t][r];
+			}
+		}
+		std::vector<int> agreement(trees.size(), 0);
+		for (size_t t = 0; t < trees.size(); ++t) {
+			for (size_t r = 0; r < rows.size(); ++r) {
+				bool majority = 2 * votes1[r] > (int)trees.size();
+				if ((treeVotes[t][r] != 0) == majority) ++agreement[t];
+			}
 		}
-		return votes1 > votes0 ? 1 : 0;
+		std::vector<int> order(trees.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return agreement[a] > agreement[b]; });
+		std::vector<DecisionTree> ordered;
+		ordered.reserve(trees.size());
+		for (int t : order) ordered.push_back(std::move(trees[t]));
+		trees = std::move(ordered);
+	}
+
+	//Fraction of trees voting survived for every row, computed tree-major: rows are scored in
+	//blocks of BatchBlockSize so each tree's nodes stay in cache for the whole block.
+	//Blocks are spread over nThreads threads (<= 0 uses every hardware thread).
+	//Throws std::runtime_error if rows have other features than the trees.
+	std::vector<double> predictBatch(const Dataset& rows, int nThreads = 1) const {
+		ThreadPool pool(nThreads);
+		return predictBatch(rows, pool);
+	}
+
+	//As predictBatch above on the threads of pool, which callers scoring many small batches keep
+	//instead of starting threads for every batch
+	std::vector<double> predictBatch(const Dataset& rows, ThreadPool& pool) const {
+		constexpr int BatchBlockSize = 256;
+		if (*rows.schema() != *featureSchema) throw std::runtime_error("rows must have the forest's feature schema");
+		size_t n = rows.size();
+		std::vector<int> votes(n, 0);
+		if (n == 0 || trees.empty()) return std::vector<double>(n, 0.0);
+
+		//Trees share the dictionaries of the data they were trained or loaded with, so the batch's
+		//category codes need translating only for trees whose dictionary is not the batch's, and
+		//only once per distinct dictionary. remapOf holds, per tree and feature, the index of the
+		//translation in remaps, or -1 when the codes are the same
+		const FeatureSchema& schema = *rows.schema();
+		int nFeatures = schema.featureCount();
+		std::vector<int> remapOf(trees.size() * nFeatures, -1);
+		std::vector<std::vector<int>> remaps;
+		std::unordered_map<const CategoryDictionary*, int> remapIndex;
+		for (size_t t = 0; t < trees.size(); ++t) {
+			for (int featureIdx = 0; featureIdx < nFeatures; ++featureIdx) {
+				if (!schema.isCategorical(featureIdx)) continue;
+				const CategoryDictionary& from = rows.dictionary(featureIdx);
+				const CategoryDictionary& to = trees[t].getCategories(featureIdx);
+				if (&to == &from) continue;
+				auto [it, added] = remapIndex.emplace(&to, (int)remaps.size());
+				if (added) {
+					std::vector<int> codes(from.size());
+					for (int code = 0; code < from.size(); ++code) codes[code] = to.find(from.decode(code));
+					remaps.push_back(std::move(codes));
+				}
+				remapOf[t * nFeatures + featureIdx] = it->second;
+			}
+		}
+
+		size_t nBlocks = (n + BatchBlockSize - 1) / BatchBlockSize;
+		int nTasks = (int)std::min<size_t>(nBlocks, (size_t)pool.threadCount() * 4);
+		pool.parallelFor(nTasks, [&](int task) {
+			std::vector<double> block(nFeatures * BatchBlockSize), remapped(nFeatures * BatchBlockSize);
+			std::vector<const double*> columns(nFeatures);
+			std::vector<int32_t> cursor(BatchBlockSize);
+			for (size_t b = nBlocks * task / nTasks; b < nBlocks * (task + 1) / nTasks; ++b) {
+				size_t begin = b * BatchBlockSize;
+				int count = (int)std::min<size_t>(BatchBlockSize, n - begin);
+				rows.encodeBlock(begin, count, BatchBlockSize, block.data());
+				for (size_t t = 0; t < trees.size(); ++t) {
+					for (int featureIdx = 0; featureIdx < nFeatures; ++featureIdx) {
+						columns[featureIdx] = block.data() + featureIdx * BatchBlockSize;
+						int remap = remapOf[t * nFeatures + featureIdx];
+						if (remap < 0) continue;
+						const std::vector<int>& codes = remaps[remap];
+						const int* column = rows.column(featureIdx).data() + begin;
+						double* values = remapped.data() + featureIdx * BatchBlockSize;
+						for (int r = 0; r < count; ++r) values[r] = codes[column[r]];
+						columns[featureIdx] = values;
+					}
+					trees[t].voteBlock(columns.data(), count, trees[t].depth(), cursor.data(), votes.data() + begin);
+				}
+			}
+		});
+
+		std::vector<double> probabilities(n);
+		for (size_t i = 0; i < n; ++i) probabilities[i] = (double)votes[i] / trees.size();
+		return probabilities;
+	}
+
+	double evaluate(const Dataset& testData, int nThreads = 1) const {
+		std::vector<double> probabilities = predictBatch(testData, nThreads);
+		int correct = 0;
+		for (size_t i = 0; i < probabilities.size(); ++i) {
+			if ((probabilities[i] > 0.5) == (testData.label()[i] == 1)) ++correct;
+		}
+		return static_cast<double>(correct) / testData.size();
 	}
 
 	double evaluate(const std::vector<Passenger>& testData) const {
@@ -64,6 +743,37 @@ public:
 		return static_cast<double>(correct) / testData.size();
 	}
 
+	//Accuracy of the last train() on its own training rows, each predicted by the trees whose
+	//bootstrap sample left it out; an estimate of the test accuracy without a holdout set.
+	//-1 if unavailable (not trained by train(), or no row was ever left out).
+	double outOfBagAccuracy() const {
+		return oobAccuracy;
+	}
+
+	const std::vector<DecisionTree>& getTrees() const {
+		return trees;
+	}
+
+	//Features the trees split on
+	const std::shared_ptr<const FeatureSchema>& schema() const {
+		return featureSchema;
+	}
+
+	//Nodes of all trees
+	size_t nodeCount() const {
+		size_t count = 0;
+		for (const DecisionTree& tree : trees) count += tree.getNodes().size();
+		return count;
+	}
+
+	//Post-training compression: DecisionTree::collapseRedundantSplits on every tree. Predictions,
+	//batch and early-exit ones included, do not change. Returns the number of nodes removed.
+	size_t collapseRedundantSplits() {
+		size_t removed = 0;
+		for (DecisionTree& tree : trees) removed += tree.collapseRedundantSplits();
+		return removed;
+	}
+
 	std::unordered_map<int, double> computeFeatureImportances() {
 		std::unordered_map<int, double> total;
 		for (const auto& tree : trees) {
@@ -80,8 +790,11 @@ public:
 		return total;
 	}
 
+	//A forest of a schema other than the Titanic one starts with it (see FeatureSchema::writeModelHeader)
 	void save(const std::string& model_file) {
 		std::fstream file(model_file, std::ios::out | std::ios::binary);
+		featureSchema->writeModelHeader(file);
+		nTrees = (int)trees.size();
 		file.write(reinterpret_cast<const char*>(&nTrees), sizeof(nTrees));
 		for (DecisionTree& tree : trees) {
 			tree.save(file);
@@ -89,17 +802,66 @@ public:
 		file.close();
 	}
 
-	void load(const std::string& model_file) {
+	//Append trees [firstTree, end) to a file written by save that holds the first firstTree trees,
+	//e.g. after addTrees on the loaded forest. The stored trees are read (not rewritten) to find
+	//where they end, the new trees go there and the tree count at the start of the file is updated
+	//last, so an interrupted append leaves the file as it was.
+	//Throws std::runtime_error if the file cannot be opened, is of another schema or does not hold
+	//firstTree trees.
+	void appendTrees(const std::string& model_file, int firstTree) {
+		std::fstream file(model_file, std::ios::in | std::ios::out | std::ios::binary);
+		if (!file.is_open()) throw std::runtime_error("cannot open " + model_file);
+		FeatureSchema::readModelHeader(file, featureSchema);
+		std::fstream::pos_type countPosition = file.tellg();
+		int stored = 0;
+		file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+		if (!file || stored != firstTree || firstTree > (int)trees.size())
+			throw std::runtime_error(model_file + " holds " + std::to_string(stored) + " trees, not " + std::to_string(firstTree));
+		for (int i = 0; i < stored; ++i) {
+			DecisionTree skipped;
+			skipped.load(file, featureSchema);
+		}
+		if (!file) throw std::runtime_error("truncated model file " + model_file);
+		file.seekp(file.tellg());
+		for (int i = firstTree; i < (int)trees.size(); ++i) {
+			trees[i].save(file);
+		}
+		file.flush();
+		nTrees = (int)trees.size();
+		file.seekp(countPosition);
+		file.write(reinterpret_cast<const char*>(&nTrees), sizeof(nTrees));
+		if (!file) throw std::runtime_error("cannot write " + model_file);
+	}
+
+	//Replaces the trees and schema with those of the file; if schema is given the file's must equal
+	//it. Throws std::runtime_error if the file cannot be read, is truncated or corrupt or is of
+	//another schema; the forest is left as it was then
+	void load(const std::string& model_file, std::shared_ptr<const FeatureSchema> schema = nullptr) {
 		std::fstream file(model_file, std::ios::in | std::ios::binary);
-		file.read(reinterpret_cast<char*>(&nTrees), sizeof(nTrees));
-		if (nTrees > 0) {
-			trees.reserve(nTrees);
-			for (int i{ 0 }; i < nTrees; ++i) {
-				DecisionTree tree;
-				tree.load(file);
-				trees.push_back(tree);
-			}
+		if (!file.is_open()) throw std::runtime_error("cannot open " + model_file);
+		schema = FeatureSchema::readModelHeader(file, std::move(schema));
+		int stored = 0;
+		file.read(reinterpret_cast<char*>(&stored), sizeof(stored));
+		if (!file || stored < 0) throw std::runtime_error("invalid model file " + model_file);
+		std::vector<DecisionTree> loaded;
+		Dataset categories(schema); //one dictionary per feature for all trees
+		for (int i{ 0 }; i < stored; ++i) {
+			DecisionTree tree;
+			tree.load(file, categories);
+			if (!file) throw std::runtime_error("truncated model file " + model_file);
+			loaded.push_back(std::move(tree));
 		}
 		file.close();
+		trees = std::move(loaded);
+		nTrees = stored;
+		featureSchema = std::move(schema);
+	}
+
+	//Every tree is well formed (see DecisionTree::isWellFormed)
+	bool isWellFormed() const {
+		for (const DecisionTree& tree : trees) {
+			if (!tree.isWellFormed()) return false;
+		}
+		return true;
 	}
 };
\ No newline at end of file
@@ -0,0 +1,65 @@
+// Scoring server for a forest written by RandomForest::save (see PredictionServer):
+//   ServeForest <forest_model.bin> <unix:PATH | tcp:PORT> [--max-batch=N] [--max-delay-us=N] [--threads=N]
+// Each request line "Pclass,Sex,Age,SibSp,Parch,Fare,Embarked" is answered by "<survived> <probability>".
+// SIGHUP reloads the model file (replace it by renaming a new file over it), SIGINT and SIGTERM stop.
+#include "PredictionServer.h"
+#include <csignal>
+#include <pthread.h>
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        std::cerr << "usage: " << argv[0] << " <forest_model.bin> <unix:PATH | tcp:PORT> [--max-batch=N] [--max-delay-us=N] [--threads=N]\n";
+        return 1;
+    }
+    std::string modelFile = argv[1];
+    std::string address = argv[2];
+    size_t maxBatch = 256;
+    long long maxDelay = 1000;
+    int nThreads = 1;
+    for (int i = 3; i < argc; ++i) {
+        std::string argument = argv[i];
+        size_t equals = argument.find('=');
+        std::string key = argument.substr(0, equals), value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+        if (key == "--max-batch" && !value.empty()) maxBatch = std::stoul(value);
+        else if (key == "--max-delay-us" && !value.empty()) maxDelay = std::stoll(value);
+        else if (key == "--threads" && !value.empty()) nThreads = std::stoi(value);
+        else {
+            std::cerr << "unknown option " << argument << "\n";
+            return 1;
+        }
+    }
+
+    //the signals are taken by sigwait below, so every thread must block them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        PredictionServer server(modelFile, maxBatch, std::chrono::microseconds(maxDelay), nThreads);
+        server.listen(address);
+        std::cout << "Serving " << server.treeCount() << " trees on "
+            << (server.port() >= 0 ? "tcp:" + std::to_string(server.port()) : address) << std::endl;
+        while (true) {
+            int signal = 0;
+            sigwait(&signals, &signal);
+            if (signal != SIGHUP) break;
+            try {
+                server.reload();
+                std::cout << "Reloaded " << modelFile << ": " << server.treeCount() << " trees" << std::endl;
+            }
+            catch (const std::exception& e) {
+                std::cerr << "Reload failed, keeping the current model: " << e.what() << std::endl;
+            }
+        }
+        server.stop();
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,3 +1,4 @@
+#include "CsvLoader.h"
 #include "RandomForest.h"
 #include <fstream>
 #include <iomanip>
@@ -9,31 +10,7 @@ std::vector<Passenger> loadData(const std::string &filename) {
     std::cerr << "File not found\n";
     exit(1);
   }
-  std::string line;
-  std::vector<Passenger> data;
-
-  std::vector<std::string> fields;
-
-  std::getline(file, line); // skip header
-  while (std::getline(file, line)) {
-    bool inQuotes = false;
-    std::string temp = "";
-    for (char c : line) {
-      if (c == '"')
-        inQuotes = !inQuotes;
-      else if (c == ',' && !inQuotes) {
-        fields.push_back(temp);
-        temp.clear();
-        temp = "";
-      } else
-        temp += c;
-    }
-    fields.push_back(temp);
-    if (fields.size() >= 12)
-      data.emplace_back(fields);
-    fields.clear();
-  }
-  return data;
+  return CsvLoader::loadPassengers(file);
 }
 
 int main() {
@@ -53,7 +30,7 @@ int main() {
                                     std::end(data));
 
     // Train and evaluate a single decision tree
-    DecisionTree tree(7, 2, 2);
+    DecisionTree tree(7, 2, 2, 1.0, 0, 0);
     tree.train(trainData);
 
     int correct = 0;
@@ -79,8 +56,9 @@ int main() {
         << (double)(correct / (double)testData.size()) << "\n";
 
   
-    RandomForest forest(100, 7, 2, 2, 0.7);
+    RandomForest forest(100, 7, 2, 2, 0.7, 0, 0);
     forest.train(trainData);
+    std::cout << "Random Forest Out-of-Bag Accuracy: " << forest.outOfBagAccuracy() << "\n";
 
     auto importance = forest.computeFeatureImportances();
     for (const auto &[feature, score] : importance) {
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Dataset.h"
+
+//Phases of training that TrainingTelemetry times. Phases nest: TreeBuild contains the split
+//search, partitioning and histograms of that tree.
+enum class TrainingPhase { Presort, Binning, Bootstrap, TreeBuild, SplitSearch, Partition, Histogram, OutOfBag, DataPass, Count };
+
+//Counters and timers filled in by training when attached with setTelemetry (DecisionTree,
+//RandomForest). Training only checks a null pointer when none is attached. Counters are atomic,
+//so one instance can be shared by trees trained concurrently; phase times are summed over threads.
+class TrainingTelemetry {
+private:
+    static constexpr int PhaseCount = (int)TrainingPhase::Count;
+    static constexpr int MaxDepthTracked = 64; //deeper nodes are counted in the last bucket
+
+    struct TreeRecord {
+        int index;
+        double seconds;
+        size_t nodes;
+        int levels;
+    };
+
+    std::atomic<int64_t> phaseNanoseconds[PhaseCount] = {};
+    std::atomic<uint64_t> phaseCalls[PhaseCount] = {};
+    std::atomic<uint64_t> depthNodes[MaxDepthTracked] = {};
+    std::shared_ptr<const FeatureSchema> schema; //names the per-feature counters
+    std::unique_ptr<std::atomic<uint64_t>[]> featureCandidates;
+    std::atomic<uint64_t> splitRows{ 0 }, partitionRows{ 0 }, histogramRows{ 0 };
+    std::atomic<uint64_t> allocations{ 0 }, reuses{ 0 };
+    std::mutex treeMutex;
+    std::vector<TreeRecord> trees;
+
+    static const char* phaseName(int phase) {
+        static const char* names[PhaseCount] = { "presort", "binning", "bootstrap", "tree_build", "split_search", "partition", "histogram",
+            "out_of_bag", "data_pass" };
+        return names[phase];
+    }
+
+public:
+    //Candidate splits are counted per feature of schema, which must be that of the training data
+    explicit TrainingTelemetry(std::shared_ptr<const FeatureSchema> schema = FeatureSchema::titanic()) :
+        schema(schema), featureCandidates(new std::atomic<uint64_t>[schema->featureCount()]()) {}
+
+    //Adds the time from its construction to its destruction to a phase; does nothing without telemetry
+    class PhaseTimer {
+    private:
+        TrainingTelemetry* telemetry;
+        TrainingPhase phase;
+        std::chrono::steady_clock::time_point start;
+
+    public:
+        PhaseTimer(TrainingTelemetry* telemetry, TrainingPhase phase) : telemetry(telemetry), phase(phase) {
+            if (telemetry) start = std::chrono::steady_clock::now();
+        }
+
+        PhaseTimer(const PhaseTimer&) = delete;
+        PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+        ~PhaseTimer() {
+            if (!telemetry) return;
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            telemetry->phaseNanoseconds[(int)phase].fetch_add(elapsed.count(), std::memory_order_relaxed);
+            telemetry->phaseCalls[(int)phase].fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+    void countNode(int depth) {
+        depthNodes[std::clamp(depth, 0, MaxDepthTracked - 1)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countCandidates(int featureIdx, uint64_t count) {
+        featureCandidates[featureIdx].fetch_add(count, std::memory_order_relaxed);
+    }
+
+    //Rows read by the split search, by partitioning and by histogram building
+    void countSplitRows(uint64_t rows) {
+        splitRows.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    void countPartitionRows(uint64_t rows) {
+        partitionRows.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    void countHistogramRows(uint64_t rows) {
+        histogramRows.fetch_add(rows, std::memory_order_relaxed);
+    }
+
+    //A training buffer taken from the heap (allocated) or from the recycled ones
+    void countBuffer(bool allocated) {
+        (allocated ? allocations : reuses).fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void recordTree(int index, double seconds, size_t nodes, int levels) {
+        std::lock_guard<std::mutex> lock(treeMutex);
+        trees.push_back({ index, seconds, nodes, levels });
+    }
+
+    double phaseSeconds(TrainingPhase phase) const {
+        return phaseNanoseconds[(int)phase].load() / 1e9;
+    }
+
+    uint64_t nodesAtDepth(int depth) const {
+        return depthNodes[std::clamp(depth, 0, MaxDepthTracked - 1)].load();
+    }
+
+    uint64_t candidateSplits(int featureIdx) const {
+        return featureCandidates[featureIdx].load();
+    }
+
+    void writeJson(std::ostream& out) {
+        out << "{\n  \"phases\": {";
+        for (int phase = 0; phase < PhaseCount; ++phase) {
+            out << (phase ? "," : "") << "\n    \"" << phaseName(phase) << "\": { \"seconds\": " << phaseNanoseconds[phase].load() / 1e9
+                << ", \"calls\": " << phaseCalls[phase].load() << " }";
+        }
+        int deepest = MaxDepthTracked;
+        while (deepest > 0 && depthNodes[deepest - 1].load() == 0) --deepest;
+        out << "\n  },\n  \"nodes_per_depth\": [";
+        for (int depth = 0; depth < deepest; ++depth) out << (depth ? ", " : "") << depthNodes[depth].load();
+        out << "],\n  \"candidate_splits_per_feature\": {";
+        for (int featureIdx = 0; featureIdx < schema->featureCount(); ++featureIdx)
+            out << (featureIdx ? ", " : " ") << "\"" << schema->name(featureIdx) << "\": " << featureCandidates[featureIdx].load();
+        out << " },\n  \"rows_scanned\": { \"split_search\": " << splitRows.load() << ", \"partition\": " << partitionRows.load()
+            << ", \"histogram\": " << histogramRows.load() << " },\n";
+        out << "  \"buffers\": { \"allocated\": " << allocations.load() << ", \"reused\": " << reuses.load() << " },\n";
+        std::vector<TreeRecord> sorted;
+        {
+            std::lock_guard<std::mutex> lock(treeMutex);
+            sorted = trees;
+        }
+        std::sort(sorted.begin(), sorted.end(), [](const TreeRecord& a, const TreeRecord& b) { return a.index < b.index; });
+        out << "  \"trees\": [";
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            out << (i ? "," : "") << "\n    { \"index\": " << sorted[i].index << ", \"seconds\": " << sorted[i].seconds
+                << ", \"nodes\": " << sorted[i].nodes << ", \"levels\": " << sorted[i].levels << " }";
+        }
+        out << (sorted.empty() ? "" : "\n  ") << "]\n}\n";
+    }
+
+    //Throws std::runtime_error if the file cannot be written
+    void writeJson(const std::string& filename) {
+        std::ofstream file(filename);
+        if (!file.is_open()) throw std::runtime_error("cannot write " + filename);
+        writeJson(file);
+    }
+};
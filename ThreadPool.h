@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Work-stealing thread pool.
+//Every worker owns a deque: it takes its own tasks from the back and steals from the front
+//of the other deques when it runs dry. The thread that waits on a batch of tasks helps run
+//them, so a pool created with nThreads uses nThreads - 1 background workers.
+class ThreadPool {
+private:
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    std::vector<std::thread> workers;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    std::atomic<int> queued{ 0 };
+    std::atomic<unsigned> nextQueue{ 0 };
+    bool stopping = false;
+
+    inline static thread_local ThreadPool* currentPool = nullptr;
+    inline static thread_local int currentWorker = -1;
+
+    int ownQueue() const {
+        return currentPool == this ? currentWorker : -1;
+    }
+
+    bool popTask(int self, std::function<void()>& task) {
+        int n = (int)queues.size();
+        if (self >= 0) {
+            WorkQueue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.tasks.empty()) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+        //steal, starting at the neighbour so thieves spread over the victims
+        for (int k = 1; k <= n; ++k) {
+            int victim = ((self < 0 ? 0 : self) + k) % n;
+            if (victim == self) continue;
+            WorkQueue& other = *queues[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+            if (!other.tasks.empty()) {
+                task = std::move(other.tasks.front());
+                other.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int index) {
+        currentPool = this;
+        currentWorker = index;
+        std::function<void()> task;
+        while (true) {
+            if (popTask(index, task)) {
+                queued.fetch_sub(1);
+                task();
+                task = nullptr;
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            wakeUp.wait(lock, [this] { return stopping || queued.load() > 0; });
+            if (stopping && queued.load() == 0) return;
+        }
+    }
+
+public:
+    //nThreads <= 0 uses every hardware thread
+    explicit ThreadPool(int nThreads = 0) {
+        if (nThreads <= 0) nThreads = std::max(1, (int)std::thread::hardware_concurrency());
+        int nWorkers = nThreads - 1;
+        //tasks submitted from outside the pool are dealt round-robin over the worker queues
+        for (int i = 0; i < std::max(1, nWorkers); ++i)
+            queues.push_back(std::make_unique<WorkQueue>());
+        for (int i = 0; i < nWorkers; ++i)
+            workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (std::thread& worker : workers) worker.join();
+    }
+
+    int threadCount() const {
+        return (int)workers.size() + 1;
+    }
+
+    void submit(std::function<void()> task) {
+        int self = ownQueue();
+        int target = self >= 0 ? self : (int)(nextQueue.fetch_add(1) % queues.size());
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        queued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+        }
+        wakeUp.notify_one();
+    }
+
+    //Run one queued task on the calling thread; returns false if there was nothing to run
+    bool runPendingTask() {
+        std::function<void()> task;
+        if (!popTask(ownQueue(), task)) return false;
+        queued.fetch_sub(1);
+        task();
+        return true;
+    }
+
+    //Call body(i) for every i in [0, n) and return once all calls have finished.
+    //The first exception thrown by a call is rethrown here.
+    template <typename Body>
+    void parallelFor(int n, Body body) {
+        if (n <= 0) return;
+        if (workers.empty()) {
+            for (int i = 0; i < n; ++i) body(i);
+            return;
+        }
+        std::atomic<int> remaining{ n };
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        for (int i = 0; i < n; ++i) {
+            submit([&, i] {
+                try {
+                    body(i);
+                }
+                catch (...) {
+                    std::lock_guard<std::mutex> lock(errorMutex);
+                    if (!error) error = std::current_exception();
+                }
+                remaining.fetch_sub(1);
+            });
+        }
+        while (remaining.load() > 0) {
+            if (!runPendingTask()) std::this_thread::yield();
+        }
+        if (error) std::rethrow_exception(error);
+    }
+};
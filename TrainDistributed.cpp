@@ -0,0 +1,139 @@
+// Data-parallel training over passenger csv shards (see RandomForest::trainDistributed):
+//   TrainDistributed <forest_model.bin> <shard.csv>... [options]
+// forks one worker process per shard, each connected to this coordinator by a pair of pipes;
+//   TrainDistributed <forest_model.bin> --listen=ADDRESS --workers=N [options]
+//   TrainDistributed --connect=ADDRESS <shard.csv> [--threads=N]
+// run the coordinator and its workers as separate processes that meet at ADDRESS (unix:PATH, or
+// tcp:PORT to listen and tcp:HOST:PORT to connect); the shards are taken in the order the workers connect.
+// Options: --trees=N --depth=N --bins=N --threads=N --seed=N --extra=0|1; --threads is per process and
+// --extra=1 trains extremely randomized trees.
+#include "CsvLoader.h"
+#include "RandomForest.h"
+#include "TrainingChannel.h"
+#include <csignal>
+#include <sys/wait.h>
+
+struct DistributedConfig {
+    std::string modelFile;
+    std::vector<std::string> shards;
+    std::string listen;
+    std::string connect;
+    int workers = 0;
+    int trees = 100;
+    int depth = 7;
+    int bins = 0;
+    int threads = 1;
+    unsigned seed = 42;
+    bool extra = false;
+};
+
+static bool parseArguments(int argc, char* argv[], DistributedConfig& config) {
+    std::vector<std::string> files;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument.compare(0, 2, "--") != 0) {
+            files.push_back(argument);
+            continue;
+        }
+        size_t equals = argument.find('=');
+        if (equals == std::string::npos) return false;
+        std::string key = argument.substr(2, equals - 2), value = argument.substr(equals + 1);
+        if (key == "listen") config.listen = value;
+        else if (key == "connect") config.connect = value;
+        else if (key == "workers") config.workers = std::stoi(value);
+        else if (key == "trees") config.trees = std::stoi(value);
+        else if (key == "depth") config.depth = std::stoi(value);
+        else if (key == "bins") config.bins = std::stoi(value);
+        else if (key == "threads") config.threads = std::stoi(value);
+        else if (key == "seed") config.seed = (unsigned)std::stoul(value);
+        else if (key == "extra") config.extra = std::stoi(value) != 0;
+        else return false;
+    }
+    if (!config.connect.empty()) {
+        config.shards = files;
+        return files.size() == 1;
+    }
+    if (files.empty()) return false;
+    config.modelFile = files[0];
+    config.shards.assign(files.begin() + 1, files.end());
+    return config.listen.empty() ? !config.shards.empty() : config.shards.empty() && config.workers > 0;
+}
+
+static Dataset loadShard(const std::string& file) {
+    Dataset shard = CsvLoader::load(file);
+    std::cout << file << ": " << shard.size() << " rows" << std::endl;
+    return shard;
+}
+
+int main(int argc, char* argv[]) {
+    DistributedConfig config;
+    if (!parseArguments(argc, argv, config)) {
+        std::cerr << "usage: " << argv[0] << " <forest_model.bin> <shard.csv>... [options]\n"
+            "       " << argv[0] << " <forest_model.bin> --listen=ADDRESS --workers=N [options]\n"
+            "       " << argv[0] << " --connect=ADDRESS <shard.csv> [--threads=N]\n"
+            "options: --trees=N --depth=N --bins=N --threads=N --seed=N --extra=0|1\n";
+        return 1;
+    }
+    std::signal(SIGPIPE, SIG_IGN);
+
+    try {
+        if (!config.connect.empty()) {
+            Dataset shard = loadShard(config.shards[0]);
+            FdChannel coordinator = FdChannel::connect(config.connect);
+            RandomForest::trainShard(shard, coordinator, config.threads);
+            return 0;
+        }
+
+        std::vector<FdChannel> workers;
+        std::vector<pid_t> children;
+        if (!config.listen.empty()) {
+            ChannelListener listener(config.listen);
+            std::cout << "Waiting for " << config.workers << " workers on " << config.listen << std::endl;
+            while ((int)workers.size() < config.workers) workers.push_back(listener.accept());
+        }
+        else {
+            for (const std::string& file : config.shards) {
+                auto [coordinatorEnd, workerEnd] = FdChannel::pipes();
+                pid_t pid = fork();
+                if (pid < 0) throw std::runtime_error("fork failed");
+                if (pid == 0) {
+                    //the worker keeps only its own channel, so the others see the coordinator's end close
+                    workers.clear();
+                    coordinatorEnd = FdChannel();
+                    int status = 0;
+                    try {
+                        RandomForest::trainShard(loadShard(file), workerEnd, config.threads);
+                    }
+                    catch (const std::exception& e) {
+                        std::cerr << file << ": " << e.what() << "\n";
+                        status = 1;
+                    }
+                    std::cout.flush();
+                    _exit(status);
+                }
+                children.push_back(pid);
+                workers.push_back(std::move(coordinatorEnd));
+            }
+        }
+
+        RandomForest forest(config.trees, config.depth, 2, 2, 0.7, config.bins, config.threads, config.seed, config.extra);
+        auto start = std::chrono::steady_clock::now();
+        forest.trainDistributed(workers);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        workers.clear();
+        bool failed = false;
+        for (pid_t pid : children) {
+            int status = 0;
+            failed |= waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+        }
+        if (failed) throw std::runtime_error("a worker failed");
+        forest.save(config.modelFile);
+        std::cout << forest.getTrees().size() << " trees trained by " << (children.empty() ? config.workers : (int)children.size())
+            << " workers in " << seconds << " s, written to " << config.modelFile << "\n";
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
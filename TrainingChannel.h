@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+#error "TrainingChannel needs POSIX pipes and sockets"
+#endif
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+//Transport of RandomForest::trainDistributed between the coordinator and one worker over file
+//descriptors: a socket, or a pair of pipes. Every message is sent as its 8-byte length and its bytes.
+//Writing to a closed pipe raises SIGPIPE, which processes using pipes should ignore.
+class FdChannel {
+private:
+    int readFd = -1;
+    int writeFd = -1;
+
+    [[noreturn]] static void fail(const std::string& what) {
+        throw std::runtime_error(what + ": " + std::strerror(errno));
+    }
+
+    void readAll(char* to, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::read(readFd, to, size);
+            if (n == 0) throw std::runtime_error("training channel closed");
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail("training channel read");
+            }
+            to += n;
+            size -= (size_t)n;
+        }
+    }
+
+    void writeAll(const char* from, size_t size) {
+        while (size > 0) {
+            ssize_t n = ::write(writeFd, from, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                fail("training channel write");
+            }
+            from += n;
+            size -= (size_t)n;
+        }
+    }
+
+    void close() {
+        if (readFd >= 0) ::close(readFd);
+        if (writeFd >= 0 && writeFd != readFd) ::close(writeFd);
+        readFd = writeFd = -1;
+    }
+
+public:
+    FdChannel() = default;
+
+    //Takes ownership of the descriptors; readFd == writeFd for a socket
+    FdChannel(int readFd, int writeFd) : readFd(readFd), writeFd(writeFd) {}
+
+    FdChannel(const FdChannel&) = delete;
+    FdChannel& operator=(const FdChannel&) = delete;
+
+    FdChannel(FdChannel&& other) noexcept :
+        readFd(std::exchange(other.readFd, -1)), writeFd(std::exchange(other.writeFd, -1)) {}
+
+    FdChannel& operator=(FdChannel&& other) noexcept {
+        if (this != &other) {
+            close();
+            readFd = std::exchange(other.readFd, -1);
+            writeFd = std::exchange(other.writeFd, -1);
+        }
+        return *this;
+    }
+
+    ~FdChannel() {
+        close();
+    }
+
+    void send(const std::string& message) {
+        uint64_t size = message.size();
+        writeAll(reinterpret_cast<const char*>(&size), sizeof(size));
+        writeAll(message.data(), message.size());
+    }
+
+    //Throws std::runtime_error if the other end has closed the channel
+    std::string receive() {
+        uint64_t size = 0;
+        readAll(reinterpret_cast<char*>(&size), sizeof(size));
+        std::string message(size, '\0');
+        readAll(&message[0], size);
+        return message;
+    }
+
+    //Two connected ends over a pair of pipes, e.g. for a worker started by fork
+    static std::pair<FdChannel, FdChannel> pipes() {
+        int down[2], up[2];
+        if (pipe(down) != 0) fail("pipe");
+        if (pipe(up) != 0) {
+            int error = errno;
+            ::close(down[0]);
+            ::close(down[1]);
+            errno = error;
+            fail("pipe");
+        }
+        return { FdChannel(up[0], down[1]), FdChannel(down[0], up[1]) };
+    }
+
+    //Two connected ends over a Unix domain socket pair
+    static std::pair<FdChannel, FdChannel> socketPair() {
+        int fds[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) fail("socketpair");
+        return { FdChannel(fds[0], fds[0]), FdChannel(fds[1], fds[1]) };
+    }
+
+    //Connect to a coordinator listening at "unix:PATH" or "tcp:HOST:PORT" (see ChannelListener).
+    //Throws std::runtime_error on failure.
+    static FdChannel connect(const std::string& address) {
+        int fd = -1;
+        if (address.compare(0, 5, "unix:") == 0) {
+            std::string path = address.substr(5);
+            sockaddr_un remote{};
+            if (path.empty() || path.size() >= sizeof(remote.sun_path)) throw std::runtime_error("invalid socket path: " + path);
+            remote.sun_family = AF_UNIX;
+            std::memcpy(remote.sun_path, path.c_str(), path.size() + 1);
+            fd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0) fail("socket");
+            if (::connect(fd, (sockaddr*)&remote, sizeof(remote)) != 0) {
+                int error = errno;
+                ::close(fd);
+                errno = error;
+                fail("cannot connect to " + path);
+            }
+        }
+        else if (address.compare(0, 4, "tcp:") == 0 && address.rfind(':') > 3) {
+            size_t colon = address.rfind(':');
+            std::string host = address.substr(4, colon - 4), port = address.substr(colon + 1);
+            addrinfo hints{}, *found = nullptr;
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            int status = getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+            if (status != 0) throw std::runtime_error("cannot resolve " + host + ": " + gai_strerror(status));
+            for (addrinfo* at = found; at != nullptr && fd < 0; at = at->ai_next) {
+                fd = socket(at->ai_family, at->ai_socktype, at->ai_protocol);
+                if (fd >= 0 && ::connect(fd, at->ai_addr, at->ai_addrlen) != 0) {
+                    ::close(fd);
+                    fd = -1;
+                }
+            }
+            freeaddrinfo(found);
+            if (fd < 0) fail("cannot connect to " + address);
+            int noDelay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        }
+        else {
+            throw std::runtime_error("address must be unix:PATH or tcp:HOST:PORT: " + address);
+        }
+        return FdChannel(fd, fd);
+    }
+};
+
+
+//Socket at which a coordinator accepts its workers: "unix:PATH" (an existing socket file at PATH is
+//replaced and removed again by the destructor) or "tcp:PORT" on every interface.
+class ChannelListener {
+private:
+    int listenFd = -1;
+    std::string socketPath;
+
+    [[noreturn]] void fail(const std::string& what) {
+        std::string message = what + ": " + std::strerror(errno);
+        if (listenFd >= 0) ::close(listenFd);
+        listenFd = -1;
+        throw std::runtime_error(message);
+    }
+
+public:
+    //Throws std::runtime_error on failure
+    explicit ChannelListener(const std::string& address) {
+        if (address.compare(0, 5, "unix:") == 0) {
+            std::string path = address.substr(5);
+            sockaddr_un local{};
+            if (path.empty() || path.size() >= sizeof(local.sun_path)) throw std::runtime_error("invalid socket path: " + path);
+            local.sun_family = AF_UNIX;
+            std::memcpy(local.sun_path, path.c_str(), path.size() + 1);
+            listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (listenFd < 0) fail("socket");
+            unlink(path.c_str());
+            if (bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) fail("cannot bind " + path);
+            socketPath = path;
+        }
+        else if (address.compare(0, 4, "tcp:") == 0) {
+            sockaddr_in local{};
+            local.sin_family = AF_INET;
+            local.sin_addr.s_addr = htonl(INADDR_ANY);
+            local.sin_port = htons((uint16_t)std::stoi(address.substr(4)));
+            listenFd = socket(AF_INET, SOCK_STREAM, 0);
+            if (listenFd < 0) fail("socket");
+            int reuse = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+            if (bind(listenFd, (sockaddr*)&local, sizeof(local)) != 0) fail("cannot bind " + address);
+        }
+        else {
+            throw std::runtime_error("address must be unix:PATH or tcp:PORT: " + address);
+        }
+        if (::listen(listenFd, SOMAXCONN) != 0) fail("listen");
+    }
+
+    ChannelListener(const ChannelListener&) = delete;
+    ChannelListener& operator=(const ChannelListener&) = delete;
+
+    ~ChannelListener() {
+        if (listenFd >= 0) ::close(listenFd);
+        if (!socketPath.empty()) unlink(socketPath.c_str());
+    }
+
+    //Wait for the next worker to connect
+    FdChannel accept() {
+        while (true) {
+            int fd = ::accept(listenFd, nullptr, nullptr);
+            if (fd >= 0) {
+                if (socketPath.empty()) {
+                    int noDelay = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+                }
+                return FdChannel(fd, fd);
+            }
+            if (errno != EINTR) throw std::runtime_error(std::string("accept: ") + std::strerror(errno));
+        }
+    }
+};
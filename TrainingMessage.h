@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+//Message of the distributed training protocol (see RandomForest::trainDistributed): values are
+//appended with put and read back in the same order with get. They are stored in the machine's own
+//representation, so the coordinator and its workers must run on the same architecture.
+class TrainingMessage {
+private:
+    std::string bytes;
+    size_t readPos = 0;
+
+    void read(void* to, size_t size) {
+        if (size > bytes.size() - readPos) throw std::runtime_error("truncated training message");
+        std::memcpy(to, bytes.data() + readPos, size);
+        readPos += size;
+    }
+
+public:
+    TrainingMessage() = default;
+    explicit TrainingMessage(std::string received) : bytes(std::move(received)) {}
+
+    const std::string& data() const {
+        return bytes;
+    }
+
+    template <typename T>
+    TrainingMessage& put(const T& value) {
+        static_assert(std::is_trivially_copyable<T>::value, "messages hold plain values");
+        bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+        return *this;
+    }
+
+    template <typename T>
+    TrainingMessage& putVector(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "messages hold plain values");
+        put<uint64_t>(values.size());
+        bytes.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+        return *this;
+    }
+
+    TrainingMessage& putString(const std::string& text) {
+        put<uint64_t>(text.size());
+        bytes.append(text);
+        return *this;
+    }
+
+    //Throw std::runtime_error if the message ends before the value
+    template <typename T>
+    T get() {
+        T value;
+        read(&value, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    std::vector<T> getVector() {
+        uint64_t size = get<uint64_t>();
+        if (size > (bytes.size() - readPos) / sizeof(T)) throw std::runtime_error("truncated training message");
+        std::vector<T> values(size);
+        if (size > 0) read(values.data(), size * sizeof(T));
+        return values;
+    }
+
+    std::string getString() {
+        uint64_t size = get<uint64_t>();
+        if (size > bytes.size() - readPos) throw std::runtime_error("truncated training message");
+        std::string text = bytes.substr(readPos, size);
+        readPos += size;
+        return text;
+    }
+};
@@ -0,0 +1,83 @@
+// Cross-validated grid search over forest hyperparameters (see CrossValidation):
+//   TuneForest <data.csv> [--folds=N] [--trees=LIST] [--depth=LIST] [--min-split=LIST] [--min-leaf=LIST]
+//              [--features=LIST] [--bins=LIST] [--extra=LIST] [--threads=N] [--seed=N]
+// LIST is comma separated values (e.g. --trees=50,100,200), all of which are combined; --extra takes
+// 0 (random forest) and 1 (extremely randomized trees). Prints the accuracy and timing of every
+// configuration, best first.
+#include "CrossValidation.h"
+#include "CsvLoader.h"
+#include <cstdio>
+#include <sstream>
+
+template <typename T>
+static std::vector<T> parseList(const std::string& text) {
+    std::vector<T> values;
+    std::stringstream items(text);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        std::stringstream parsed(item);
+        T value{};
+        if (!(parsed >> value)) throw std::invalid_argument("invalid value " + item);
+        values.push_back(value);
+    }
+    if (values.empty()) throw std::invalid_argument("empty list");
+    return values;
+}
+
+int main(int argc, char* argv[]) {
+    std::string dataFile;
+    ParamGrid grid;
+    int folds = 5, threads = 0;
+    unsigned seed = 42;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string argument = argv[i];
+            size_t equals = argument.find('=');
+            std::string key = argument.substr(0, equals), value = equals == std::string::npos ? "" : argument.substr(equals + 1);
+            if (argument.compare(0, 2, "--") != 0 && dataFile.empty()) dataFile = argument;
+            else if (key == "--folds" && !value.empty()) folds = std::stoi(value);
+            else if (key == "--trees" && !value.empty()) grid.nTrees = parseList<int>(value);
+            else if (key == "--depth" && !value.empty()) grid.maxDepth = parseList<int>(value);
+            else if (key == "--min-split" && !value.empty()) grid.minSamplesSplit = parseList<int>(value);
+            else if (key == "--min-leaf" && !value.empty()) grid.minSamplesLeaf = parseList<int>(value);
+            else if (key == "--features" && !value.empty()) grid.featureSampleRatio = parseList<double>(value);
+            else if (key == "--bins" && !value.empty()) grid.maxBins = parseList<int>(value);
+            else if (key == "--extra" && !value.empty()) {
+                std::vector<int> extra = parseList<int>(value);
+                grid.extraTrees.assign(extra.begin(), extra.end());
+            }
+            else if (key == "--threads" && !value.empty()) threads = std::stoi(value);
+            else if (key == "--seed" && !value.empty()) seed = (unsigned)std::stoul(value);
+            else throw std::invalid_argument("unknown option " + argument);
+        }
+        if (dataFile.empty()) throw std::invalid_argument("no data file");
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\nusage: " << argv[0] << " <data.csv> [--folds=N] [--trees=LIST] [--depth=LIST] [--min-split=LIST]"
+            " [--min-leaf=LIST] [--features=LIST] [--bins=LIST] [--extra=LIST] [--threads=N] [--seed=N]\n";
+        return 1;
+    }
+
+    try {
+        Dataset data = CsvLoader::load(dataFile);
+        auto start = std::chrono::steady_clock::now();
+        CrossValidation validation(data, folds, seed, threads);
+        std::vector<CrossValidationScore> scores = validation.evaluate(grid);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        CrossValidation::sortByAccuracy(scores);
+
+        std::printf("%6s %6s %9s %8s %8s %5s %5s %9s %8s %9s %9s\n",
+            "trees", "depth", "min_split", "min_leaf", "features", "bins", "extra", "accuracy", "stddev", "train_s", "eval_s");
+        for (const CrossValidationScore& score : scores) {
+            const ForestParams& p = score.params;
+            std::printf("%6d %6d %9d %8d %8.2f %5d %5d %9.4f %8.4f %9.3f %9.3f\n", p.nTrees, p.maxDepth, p.minSamplesSplit, p.minSamplesLeaf,
+                p.featureSampleRatio, p.maxBins, (int)p.extraTrees, score.accuracy, score.accuracyStdDev, score.trainSeconds, score.evaluateSeconds);
+        }
+        std::printf("%zu configurations, %d folds, %zu rows in %.3f s\n", scores.size(), folds, data.size(), seconds);
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,82 @@
+// Checks of incremental forest growth and of appending trees to model files:
+//   WarmStartTest [titanic.csv]
+// A forest of n trees grown by m with addTrees must save to the same bytes as n + m trees trained at
+// once, also after a save/load round trip and when the new trees are appended with appendTrees.
+// MappedForest::append on a file that is mapped must leave the open MappedForest answering with its
+// n trees, while a new one answers with all n + m. Prints the failures and returns 1 if there are any.
+#include "CsvLoader.h"
+#include "ModelFile.h"
+
+static std::string readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+int main(int argc, char* argv[]) {
+    std::string dataFile = argc > 1 ? argv[1] : "titanic.csv";
+    std::string wholeFile = "warm_start_test_whole.bin", grownFile = "warm_start_test_grown.bin", mappedFile = "warm_start_test.rfm";
+    const int n = 20, m = 200;
+    int failures = 0;
+    try {
+        Dataset data = CsvLoader::load(dataFile);
+        std::ifstream in(dataFile);
+        std::vector<Passenger> passengers = CsvLoader::loadPassengers(in);
+
+        RandomForest whole(n + m, 6, 2, 1, 0.7, 0, 0, 42);
+        whole.train(data);
+        whole.save(wholeFile);
+        std::string expected = readFile(wholeFile);
+
+        RandomForest grown(n, 6, 2, 1, 0.7, 0, 0, 42);
+        grown.train(data);
+        grown.addTrees(data, m);
+        grown.save(grownFile);
+        if (readFile(grownFile) != expected) {
+            std::cerr << "addTrees differs from training " << n + m << " trees at once\n";
+            ++failures;
+        }
+
+        RandomForest first(n, 6, 2, 1, 0.7, 0, 0, 42);
+        first.train(data);
+        first.save(grownFile);
+        MappedForest::save(first, mappedFile);
+        RandomForest loaded(n, 6, 2, 1, 0.7, 0, 0, 42);
+        loaded.load(grownFile);
+        loaded.addTrees(data, m);
+        loaded.appendTrees(grownFile, n);
+        if (readFile(grownFile) != expected) {
+            std::cerr << "appendTrees after load differs from training " << n + m << " trees at once\n";
+            ++failures;
+        }
+
+        MappedForest live(mappedFile);
+        MappedForest::append(loaded, n, mappedFile);
+        MappedForest reopened(mappedFile);
+        if (live.treeCount() != (size_t)n || reopened.treeCount() != (size_t)(n + m)) {
+            std::cerr << "tree counts " << live.treeCount() << " and " << reopened.treeCount() << " after append\n";
+            ++failures;
+        }
+        std::vector<double> before = live.predictBatch(data), after = reopened.predictBatch(data);
+        std::vector<double> beforeExpected = first.predictBatch(data), afterExpected = whole.predictBatch(data);
+        int differences = 0;
+        for (size_t i = 0; i < passengers.size(); ++i) {
+            if (live.predict(passengers[i]) != first.predict(passengers[i]) || reopened.predict(passengers[i]) != whole.predict(passengers[i])) ++differences;
+        }
+        for (size_t i = 0; i < data.size(); ++i) {
+            if (before[i] != beforeExpected[i] || after[i] != afterExpected[i]) ++differences;
+        }
+        if (differences > 0) {
+            std::cerr << differences << " predictions of the mapped forests differ\n";
+            ++failures;
+        }
+        std::cout << n << " + " << m << " trees, " << failures << " failures" << std::endl;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        ++failures;
+    }
+    std::remove(wholeFile.c_str());
+    std::remove(grownFile.c_str());
+    std::remove(mappedFile.c_str());
+    return failures == 0 ? 0 : 1;
+}